@@ -0,0 +1,147 @@
+// Micro-benchmark of the number and colour writers used by the text
+// renderers (src/TextWriter.h) against the fmt format strings they replace.
+//
+// Build and run from the repository root:
+//
+//   g++ -std=c++17 -O2 -DFMT_HEADER_ONLY -Isrc -Isrc/lib bench/text_writer.cpp -o text_writer
+//   ./text_writer
+//
+// The output of both variants is compared, the benchmark fails if they
+// differ.
+
+#include "TextWriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using httpgd::color_t;
+using namespace httpgd::dc;
+
+namespace
+{
+    constexpr int repetitions = 5;
+
+    template <typename F>
+    double best_of(F &&t_fn, std::string &t_out)
+    {
+        double best = 1e300;
+        for (int i = 0; i < repetitions; ++i)
+        {
+            fmt::memory_buffer os;
+            const auto start = std::chrono::steady_clock::now();
+            t_fn(os);
+            const auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+            t_out = fmt::to_string(os);
+        }
+        return best;
+    }
+
+    bool compare(const char *t_name, double t_fmt_ms, const std::string &t_fmt_out,
+                 double t_writer_ms, const std::string &t_writer_out)
+    {
+        const bool equal = t_fmt_out == t_writer_out;
+        std::printf("%-12s fmt %9.2f ms   writer %9.2f ms   speedup %5.2fx   %s\n",
+                    t_name, t_fmt_ms, t_writer_ms, t_fmt_ms / t_writer_ms, equal ? "ok" : "OUTPUT DIFFERS");
+        return equal;
+    }
+} // namespace
+
+int main()
+{
+    // A 500k vertex polyline in plot coordinates
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> coord(-50.0, 1000.0);
+    std::vector<double> xs(500000), ys(500000);
+    for (std::size_t i = 0; i < xs.size(); ++i)
+    {
+        xs[i] = coord(rng);
+        ys[i] = coord(rng);
+    }
+    std::vector<color_t> colors(500000);
+    std::uniform_int_distribution<color_t> col(INT_MIN, INT_MAX);
+    for (auto &c : colors)
+    {
+        c = col(rng);
+    }
+    std::string text;
+    for (int i = 0; i < 100000; ++i)
+    {
+        text += (i % 10 == 0) ? "<a & b>" : "plain text ";
+    }
+
+    bool ok = true;
+    std::string fmt_out, writer_out;
+    double fmt_ms, writer_ms;
+
+    fmt_ms = best_of([&](fmt::memory_buffer &os) {
+        for (std::size_t i = 0; i < xs.size(); ++i)
+        {
+            fmt::format_to(std::back_inserter(os), "{:.2f},{:.2f} ", xs[i], ys[i]);
+        }
+    }, fmt_out);
+    writer_ms = best_of([&](fmt::memory_buffer &os) {
+        for (std::size_t i = 0; i < xs.size(); ++i)
+        {
+            write_to(os, fixed2(xs[i]), ",", fixed2(ys[i]), " ");
+        }
+    }, writer_out);
+    ok &= compare("points", fmt_ms, fmt_out, writer_ms, writer_out);
+
+    fmt_ms = best_of([&](fmt::memory_buffer &os) {
+        for (const auto c : colors)
+        {
+            fmt::format_to(std::back_inserter(os), "#{:02X}{:02X}{:02X};", color::red(c), color::green(c), color::blue(c));
+        }
+    }, fmt_out);
+    writer_ms = best_of([&](fmt::memory_buffer &os) {
+        for (const auto c : colors)
+        {
+            write_to(os, hex_color(c), ";");
+        }
+    }, writer_out);
+    ok &= compare("colors", fmt_ms, fmt_out, writer_ms, writer_out);
+
+    fmt_ms = best_of([&](fmt::memory_buffer &os) {
+        for (const char &c : text)
+        {
+            switch (c)
+            {
+            case '&':
+                fmt::format_to(std::back_inserter(os), "&amp;");
+                break;
+            case '<':
+                fmt::format_to(std::back_inserter(os), "&lt;");
+                break;
+            case '>':
+                fmt::format_to(std::back_inserter(os), "&gt;");
+                break;
+            default:
+                fmt::format_to(std::back_inserter(os), "{}", c);
+            }
+        }
+    }, fmt_out);
+    writer_ms = best_of([&](fmt::memory_buffer &os) {
+        write_escaped(os, text, [](char c) -> const char * {
+            switch (c)
+            {
+            case '&':
+                return "&amp;";
+            case '<':
+                return "&lt;";
+            case '>':
+                return "&gt;";
+            default:
+                return nullptr;
+            }
+        });
+    }, writer_out);
+    ok &= compare("xml escape", fmt_ms, fmt_out, writer_ms, writer_out);
+
+    return ok ? 0 : 1;
+}
@@ -1,5 +1,12 @@
 #include "Base64.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
 extern "C"
 {
@@ -10,39 +17,70 @@ namespace httpgd
 {
     const static char encode_lookup[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     const static char pad_character = '=';
-    inline std::string base64_encode(const std::uint8_t *buffer, size_t size)
+
+#if defined(__SSSE3__)
+    // Encodes the first 12 bytes of t_in to 16 characters
+    // (W. Mula, "Base64 encoding with SIMD instructions").
+    static inline __m128i base64_encode_block(__m128i t_in)
+    {
+        // split 3 bytes into 4 6-bit indices (one per byte)
+        t_in = _mm_shuffle_epi8(t_in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m128i t0 = _mm_and_si128(t_in, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(t_in, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        const __m128i indices = _mm_or_si128(t1, t3);
+
+        // index -> character: add the offset of the range the index falls into
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+        const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                              '/' - 63, 'A', 0, 0);
+        return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+    }
+#endif
+
+    std::string base64_encode(const std::uint8_t *buffer, size_t size)
     {
-        std::string encoded_string;
-        encoded_string.reserve(((size / 3) + (size % 3 > 0)) * 4);
-        std::uint32_t temp{};
-        int index = 0;
-        for (size_t idx = 0; idx < size / 3; idx++)
-        {
-            temp = buffer[index++] << 16; //Convert to big endian
-            temp += buffer[index++] << 8;
-            temp += buffer[index++];
-            encoded_string.append(1, encode_lookup[(temp & 0x00FC0000) >> 18]);
-            encoded_string.append(1, encode_lookup[(temp & 0x0003F000) >> 12]);
-            encoded_string.append(1, encode_lookup[(temp & 0x00000FC0) >> 6]);
-            encoded_string.append(1, encode_lookup[(temp & 0x0000003F)]);
+        std::string encoded_string(((size / 3) + (size % 3 > 0)) * 4, pad_character);
+        char *out = &encoded_string[0];
+        size_t index = 0;
+#if defined(__SSSE3__)
+        // 16 bytes are loaded per 12 encoded
+        for (; index + 16 <= size; index += 12, out += 16)
+        {
+            const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + index));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), base64_encode_block(in));
+        }
+#endif
+        for (; index + 3 <= size; index += 3, out += 4)
+        {
+            const std::uint32_t temp = (buffer[index] << 16) | (buffer[index + 1] << 8) | buffer[index + 2]; //Convert to big endian
+            out[0] = encode_lookup[(temp & 0x00FC0000) >> 18];
+            out[1] = encode_lookup[(temp & 0x0003F000) >> 12];
+            out[2] = encode_lookup[(temp & 0x00000FC0) >> 6];
+            out[3] = encode_lookup[(temp & 0x0000003F)];
         }
         switch (size % 3)
         {
         case 1:
-            temp = buffer[index++] << 16; //Convert to big endian
-            encoded_string.append(1, encode_lookup[(temp & 0x00FC0000) >> 18]);
-            encoded_string.append(1, encode_lookup[(temp & 0x0003F000) >> 12]);
-            encoded_string.append(2, pad_character);
+        {
+            const std::uint32_t temp = buffer[index] << 16;
+            out[0] = encode_lookup[(temp & 0x00FC0000) >> 18];
+            out[1] = encode_lookup[(temp & 0x0003F000) >> 12];
             break;
+        }
         case 2:
-            temp = buffer[index++] << 16; //Convert to big endian
-            temp += buffer[index++] << 8;
-            encoded_string.append(1, encode_lookup[(temp & 0x00FC0000) >> 18]);
-            encoded_string.append(1, encode_lookup[(temp & 0x0003F000) >> 12]);
-            encoded_string.append(1, encode_lookup[(temp & 0x00000FC0) >> 6]);
-            encoded_string.append(1, pad_character);
+        {
+            const std::uint32_t temp = (buffer[index] << 16) | (buffer[index + 1] << 8);
+            out[0] = encode_lookup[(temp & 0x00FC0000) >> 18];
+            out[1] = encode_lookup[(temp & 0x0003F000) >> 12];
+            out[2] = encode_lookup[(temp & 0x00000FC0) >> 6];
             break;
         }
+        }
         return encoded_string;
     }
 
@@ -51,67 +89,81 @@ namespace httpgd
         std::vector<uint8_t> *p = (std::vector<uint8_t> *)png_get_io_ptr(png_ptr);
         p->insert(p->end(), data, data + length);
     }
-    inline std::string raster_to_string(std::vector<unsigned int> raster_, int w, int h, double width, double height, bool interpolate)
-    {
-        unsigned int *raster = raster_.data();
-
-        h = h < 0 ? -h : h;
-        w = w < 0 ? -w : w;
-        bool resize = false;
-        int w_fac = 1, h_fac = 1;
-        std::vector<unsigned int> raster_resize;
 
+    // Integer factors non-interpolated rasters are upscaled with, so that
+    // browsers do not blur them when they are drawn at their target size.
+    static gvertex<int> upscale_factors(int w, int h, double width, double height, bool interpolate)
+    {
+        gvertex<int> fac{1, 1};
         if (!interpolate && double(w) < width)
         {
-            resize = true;
-            w_fac = std::ceil(width / w);
+            fac.x = std::ceil(width / w);
         }
         if (!interpolate && double(h) < height)
         {
-            resize = true;
-            h_fac = std::ceil(height / h);
+            fac.y = std::ceil(height / h);
         }
+        return fac;
+    }
 
-        if (resize)
+    // Nearest neighbour upscaling: Every source row is widened once, the
+    // copies of it are replicated with memcpy.
+    static std::vector<unsigned int> upscale(const unsigned int *raster, int w, int h, gvertex<int> fac)
+    {
+        const std::size_t w_new = static_cast<std::size_t>(w) * fac.x;
+        std::vector<unsigned int> raster_resize(w_new * h * fac.y);
+        unsigned int *out = raster_resize.data();
+        for (int i = 0; i < h; ++i)
         {
-            int w_new = w * w_fac;
-            int h_new = h * h_fac;
-            raster_resize.reserve(w_new * h_new);
-            for (int i = 0; i < h; ++i)
+            const unsigned int *row = raster + static_cast<std::size_t>(i) * w;
+            unsigned int *first = out;
+            if (fac.x == 1)
+            {
+                std::memcpy(out, row, w_new * sizeof(unsigned int));
+                out += w_new;
+            }
+            else
             {
                 for (int j = 0; j < w; ++j)
                 {
-                    unsigned int val = raster[i * w + j];
-                    for (int wrep = 0; wrep < w_fac; ++wrep)
-                    {
-                        raster_resize.push_back(val);
-                    }
-                }
-                for (int hrep = 1; hrep < h_fac; ++hrep)
-                {
-                    raster_resize.insert(raster_resize.end(), raster_resize.end() - w_new, raster_resize.end());
+                    out = std::fill_n(out, fac.x, row[j]);
                 }
             }
+            for (int hrep = 1; hrep < fac.y; ++hrep)
+            {
+                std::memcpy(out, first, w_new * sizeof(unsigned int));
+                out += w_new;
+            }
+        }
+        return raster_resize;
+    }
+
+    static std::vector<std::uint8_t> raster_to_png(const unsigned int *raster, int w, int h, gvertex<int> fac, bool fast)
+    {
+        std::vector<unsigned int> raster_resize;
+        if (fac.x > 1 || fac.y > 1)
+        {
+            raster_resize = upscale(raster, w, h, fac);
             raster = raster_resize.data();
-            w = w_new;
-            h = h_new;
+            w *= fac.x;
+            h *= fac.y;
         }
 
         png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
         if (!png)
         {
-            return "";
+            return {};
         }
         png_infop info = png_create_info_struct(png);
         if (!info)
         {
             png_destroy_write_struct(&png, (png_infopp)NULL);
-            return "";
+            return {};
         }
         if (setjmp(png_jmpbuf(png)))
         {
             png_destroy_write_struct(&png, &info);
-            return "";
+            return {};
         }
         png_set_IHDR(
             png,
@@ -122,10 +174,17 @@ namespace httpgd
             PNG_INTERLACE_NONE,
             PNG_COMPRESSION_TYPE_DEFAULT,
             PNG_FILTER_TYPE_DEFAULT);
+        if (fast)
+        {
+            // A single cheap filter instead of trying all of them per row,
+            // and the fastest zlib level (1).
+            png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+            png_set_compression_level(png, 1);
+        }
         std::vector<uint8_t *> rows(h);
         for (int y = 0; y < h; ++y)
         {
-            rows[y] = (uint8_t *)raster + y * w * 4;
+            rows[y] = (uint8_t *)raster + static_cast<std::size_t>(y) * w * 4; // not modified by libpng
         }
 
         std::vector<std::uint8_t> buffer;
@@ -134,12 +193,38 @@ namespace httpgd
         png_write_png(png, info, PNG_TRANSFORM_IDENTITY, NULL);
         png_destroy_write_struct(&png, &info);
 
-        return base64_encode(buffer.data(), buffer.size());
+        return buffer;
     }
 
-    std::string raster_base64(const dc::Raster &t_raster)
+    std::vector<std::uint8_t> raster_png(const dc::Raster &t_raster, bool t_fast)
     {
-        return raster_to_string(t_raster.raster, t_raster.wh.x, t_raster.wh.y, t_raster.rect.width, t_raster.rect.height, t_raster.interpolate);
+        const int w = std::abs(t_raster.wh.x);
+        const int h = std::abs(t_raster.wh.y);
+        const auto fac = upscale_factors(w, h, t_raster.rect.width, t_raster.rect.height, t_raster.interpolate);
+        return raster_to_png(t_raster.raster.data(), w, h, fac, t_fast);
+    }
+
+    std::shared_ptr<const std::string> raster_base64(const dc::Raster &t_raster, bool t_fast)
+    {
+        const int w = std::abs(t_raster.wh.x);
+        const int h = std::abs(t_raster.wh.y);
+        const auto fac = upscale_factors(w, h, t_raster.rect.width, t_raster.rect.height, t_raster.interpolate);
+        const gvertex<int> size{w * fac.x, h * fac.y};
+        if (t_raster.cache)
+        {
+            if (auto encoded = t_raster.cache->get(size, t_fast))
+            {
+                return encoded;
+            }
+        }
+        // concurrent renders may encode it twice, which is harmless
+        const auto png = raster_to_png(t_raster.raster.data(), w, h, fac, t_fast);
+        auto encoded = std::make_shared<const std::string>(base64_encode(png.data(), png.size()));
+        if (t_raster.cache)
+        {
+            t_raster.cache->put(size, t_fast, encoded);
+        }
+        return encoded;
     }
 
-} // namespace httpgd
\ No newline at end of file
+} // namespace httpgd
@@ -3,9 +3,20 @@
 
 #include "DrawData.h"
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace httpgd
 {
-    std::string raster_base64(const dc::Raster &t_raster);
+    std::string base64_encode(const std::uint8_t *buffer, size_t size);
+    // PNG image of t_raster (upscaled to its target size if it is not
+    // interpolated), empty on error.
+    std::vector<std::uint8_t> raster_png(const dc::Raster &t_raster, bool t_fast = false);
+    // PNG image of t_raster (base64), memoized in t_raster.cache.
+    // t_fast: Quicker to encode but larger (for on-screen use).
+    std::shared_ptr<const std::string> raster_base64(const dc::Raster &t_raster, bool t_fast = false);
 
 } // namespace httpgd
 
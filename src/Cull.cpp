@@ -0,0 +1,139 @@
+#include "Cull.h"
+#include "SpatialIndex.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace httpgd::dc
+{
+    static inline void hash_combine(std::size_t &t_hash, std::size_t t_value)
+    {
+        t_hash ^= t_value + 0x9e3779b9 + (t_hash << 6) + (t_hash >> 2);
+    }
+
+    // Overdrawing the shape does not change its look
+    static inline bool overdraw_safe(const LineInfo &t_line, color_t t_fill)
+    {
+        const bool line_safe = t_line.lty == LineInfo::BLANK || color::opaque(t_line.col) || color::transparent(t_line.col);
+        const bool fill_safe = color::opaque(t_fill) || color::transparent(t_fill);
+        return line_safe && fill_safe;
+    }
+
+    bool Culler::Shape::operator==(const Shape &t_other) const
+    {
+        return type == t_other.type && line_id == t_other.line_id && fill == t_other.fill &&
+               x == t_other.x && y == t_other.y && w == t_other.w && h == t_other.h;
+    }
+
+    std::size_t Culler::ShapeHash::operator()(const Shape &t_shape) const
+    {
+        std::size_t h = std::hash<std::int64_t>{}(t_shape.x);
+        hash_combine(h, std::hash<std::int64_t>{}(t_shape.y));
+        hash_combine(h, std::hash<std::int64_t>{}(t_shape.w));
+        hash_combine(h, std::hash<std::int64_t>{}(t_shape.h));
+        hash_combine(h, std::hash<style_id_t>{}(t_shape.line_id));
+        hash_combine(h, std::hash<color_t>{}(t_shape.fill));
+        return h;
+    }
+
+    Culler::Culler(bool t_enabled)
+        : m_enabled(t_enabled)
+    {
+    }
+
+    void Culler::begin(const Page &t_page, double t_scale)
+    {
+        m_scale = t_scale;
+        m_reset();
+        if (!t_page.cps.empty())
+        {
+            m_clip_id = t_page.cps.front().id;
+            m_clip = t_page.cps.front().rect;
+        }
+    }
+
+    bool Culler::skip(const Page &t_page, const DrawCall &t_dc)
+    {
+        if (!m_enabled)
+        {
+            return false;
+        }
+        if (t_dc.type != DrawCallType::CIRCLE && t_dc.type != DrawCallType::RECT)
+        {
+            m_reset();
+            return false;
+        }
+        if (t_dc.clip_id != m_clip_id)
+        {
+            const auto it = std::find_if(t_page.cps.begin(), t_page.cps.end(), [&](const Clip &clip) {
+                return clip.id == t_dc.clip_id;
+            });
+            if (it == t_page.cps.end())
+            {
+                return false;
+            }
+            m_reset();
+            m_clip_id = it->id;
+            m_clip = it->rect;
+        }
+        m_skip = false;
+        t_page.render(t_dc, this);
+        return m_skip;
+    }
+
+    void Culler::circle(const Circle &t_circle)
+    {
+        const double r = t_circle.radius + stroke_margin(t_circle.line);
+        if (m_outside_clip(t_circle.pos.x - r, t_circle.pos.y - r, t_circle.pos.x + r, t_circle.pos.y + r))
+        {
+            m_skip = true;
+            return;
+        }
+        if (overdraw_safe(t_circle.line, t_circle.fill))
+        {
+            m_skip = !m_shapes.insert({DrawCallType::CIRCLE, t_circle.line_id, t_circle.fill,
+                                       m_px(t_circle.pos.x), m_px(t_circle.pos.y), m_px(t_circle.radius), 0})
+                          .second;
+        }
+    }
+
+    void Culler::rect(const Rect &t_rect)
+    {
+        const double m = stroke_margin(t_rect.line);
+        const double x0 = std::min(t_rect.rect.x, t_rect.rect.x + t_rect.rect.width);
+        const double x1 = std::max(t_rect.rect.x, t_rect.rect.x + t_rect.rect.width);
+        const double y0 = std::min(t_rect.rect.y, t_rect.rect.y + t_rect.rect.height);
+        const double y1 = std::max(t_rect.rect.y, t_rect.rect.y + t_rect.rect.height);
+        if (m_outside_clip(x0 - m, y0 - m, x1 + m, y1 + m))
+        {
+            m_skip = true;
+            return;
+        }
+        if (overdraw_safe(t_rect.line, t_rect.fill))
+        {
+            m_skip = !m_shapes.insert({DrawCallType::RECT, t_rect.line_id, t_rect.fill,
+                                       m_px(x0), m_px(y0), m_px(x1), m_px(y1)})
+                          .second;
+        }
+    }
+
+    bool Culler::m_outside_clip(double t_x0, double t_y0, double t_x1, double t_y1) const
+    {
+        return t_x1 < m_clip.x || t_x0 > m_clip.x + m_clip.width ||
+               t_y1 < m_clip.y || t_y0 > m_clip.y + m_clip.height;
+    }
+
+    void Culler::m_reset()
+    {
+        if (!m_shapes.empty())
+        {
+            m_shapes.clear();
+        }
+    }
+
+    std::int64_t Culler::m_px(double t_value) const
+    {
+        return std::llround(t_value * m_scale);
+    }
+
+} // namespace httpgd::dc
@@ -0,0 +1,64 @@
+#ifndef HTTPGD_CULL_H
+#define HTTPGD_CULL_H
+
+#include "DrawData.h"
+#include "HttpgdGeom.h"
+
+#include <cstdint>
+#include <unordered_set>
+
+namespace httpgd::dc
+{
+    /**
+     * Decides at render time which circles and rects can be left out
+     * without changing the output at the rendered resolution:
+     * - Shapes that lie completely outside of their clip rectangle.
+     * - Shapes that coincide (in rounded output pixels) with an
+     *   identically styled shape drawn earlier in the same run of
+     *   circles and rects. Only shapes without partial transparency
+     *   are dropped, as overdrawing would change their opacity.
+     * Any other draw call or clip change starts a new run.
+     * Dense scatter plots are the typical beneficiaries.
+     */
+    class Culler : private Renderer
+    {
+    public:
+        explicit Culler(bool t_enabled = false);
+        // t_scale: Output pixels per page unit
+        void begin(const Page &t_page, double t_scale);
+        // true if t_dc can be left out
+        bool skip(const Page &t_page, const DrawCall &t_dc);
+
+    private:
+        struct Shape
+        {
+            DrawCallType type;
+            style_id_t line_id;
+            color_t fill;
+            std::int64_t x, y, w, h;
+
+            bool operator==(const Shape &t_other) const;
+        };
+        struct ShapeHash
+        {
+            std::size_t operator()(const Shape &t_shape) const;
+        };
+
+        bool m_enabled;
+        double m_scale = 1.0;
+        clip_id_t m_clip_id = 0;
+        grect<double> m_clip{};
+        std::unordered_set<Shape, ShapeHash> m_shapes;
+        bool m_skip = false;
+
+        void circle(const Circle &t_circle) override;
+        void rect(const Rect &t_rect) override;
+
+        bool m_outside_clip(double t_x0, double t_y0, double t_x1, double t_y1) const;
+        void m_reset();
+        [[nodiscard]] std::int64_t m_px(double t_value) const;
+    };
+
+} // namespace httpgd::dc
+
+#endif // HTTPGD_CULL_H
@@ -1,120 +1,423 @@
 
 #include "DrawData.h"
+#include "SpatialIndex.h"
 
+#include <algorithm>
 #include <cmath>
+#include <functional>
 #include <string>
 #include <vector>
 
 namespace httpgd::dc
 {
-    void DrawCall::render(Renderer *t_renderer) const
+    static inline void hash_combine(std::size_t &t_hash, std::size_t t_value)
     {
-        t_renderer->dc(*this);
+        t_hash ^= t_value + 0x9e3779b9 + (t_hash << 6) + (t_hash >> 2);
     }
-    void Text::render(Renderer *t_renderer) const
+
+    bool LineInfo::operator==(const LineInfo &t_other) const
     {
-        t_renderer->text(*this);
+        return col == t_other.col &&
+               lwd == t_other.lwd &&
+               lty == t_other.lty &&
+               lend == t_other.lend &&
+               ljoin == t_other.ljoin &&
+               lmitre == t_other.lmitre;
     }
-    void Line::render(Renderer *t_renderer) const
+    std::size_t LineInfoHash::operator()(const LineInfo &t_line) const
     {
-        t_renderer->line(*this);
+        std::size_t h = std::hash<color_t>{}(t_line.col);
+        hash_combine(h, std::hash<double>{}(t_line.lwd));
+        hash_combine(h, std::hash<int>{}(t_line.lty));
+        hash_combine(h, std::hash<int>{}(t_line.lend));
+        hash_combine(h, std::hash<int>{}(t_line.ljoin));
+        hash_combine(h, std::hash<double>{}(t_line.lmitre));
+        return h;
     }
-    void Polyline::render(Renderer *t_renderer) const
+
+    bool TextInfo::operator==(const TextInfo &t_other) const
     {
-        t_renderer->polyline(*this);
+        return weight == t_other.weight &&
+               features == t_other.features &&
+               font_family == t_other.font_family &&
+               fontsize == t_other.fontsize &&
+               italic == t_other.italic;
     }
-    void Polygon::render(Renderer *t_renderer) const
+    std::size_t TextInfoHash::operator()(const TextInfo &t_text) const
     {
-        t_renderer->polygon(*this);
+        std::size_t h = std::hash<int>{}(t_text.weight);
+        hash_combine(h, std::hash<std::string>{}(t_text.features));
+        hash_combine(h, std::hash<std::string>{}(t_text.font_family));
+        hash_combine(h, std::hash<double>{}(t_text.fontsize));
+        hash_combine(h, std::hash<bool>{}(t_text.italic));
+        return h;
     }
-    void Raster::render(Renderer *t_renderer) const
+
+    Clip::Clip(clip_id_t t_id, grect<double> t_rect)
+        : id(t_id), rect(t_rect)
     {
-        t_renderer->raster(*this);
     }
-    void Path::render(Renderer *t_renderer) const
+    
+    bool Clip::equals(grect<double> t_rect) const
     {
-        t_renderer->path(*this);
+        return rect_equals(t_rect, rect, 0.01);
     }
-    void Circle::render(Renderer *t_renderer) const
+
+    std::shared_ptr<const std::string> RasterCache::get(gvertex<int> t_size, bool t_fast) const
     {
-        t_renderer->circle(*this);
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const auto it = std::find_if(m_entries.begin(), m_entries.end(), [&](const Entry &t_entry) {
+            return t_entry.size.x == t_size.x && t_entry.size.y == t_size.y && t_entry.fast == t_fast;
+        });
+        if (it == m_entries.end())
+        {
+            return nullptr;
+        }
+        // mark as most recently used
+        std::rotate(m_entries.begin(), it, std::next(it));
+        return m_entries.front().encoded;
     }
-    void Rect::render(Renderer *t_renderer) const
+
+    void RasterCache::put(gvertex<int> t_size, bool t_fast, std::shared_ptr<const std::string> t_encoded)
     {
-        t_renderer->rect(*this);
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), [&](const Entry &t_entry) {
+                            return t_entry.size.x == t_size.x && t_entry.size.y == t_size.y && t_entry.fast == t_fast;
+                        }),
+                        m_entries.end());
+        m_entries.insert(m_entries.begin(), Entry{t_size, t_fast, std::move(t_encoded)});
+
+        // the newest entry is always kept
+        std::size_t bytes = 0;
+        std::size_t count = 0;
+        for (const auto &entry : m_entries)
+        {
+            bytes += entry.encoded->size();
+            if (count > 0 && (count == max_entries || bytes > max_bytes))
+            {
+                break;
+            }
+            ++count;
+        }
+        m_entries.erase(m_entries.begin() + count, m_entries.end());
     }
 
-    Text::Text(color_t t_col, gvertex<double> t_pos, std::string &&t_str, double t_rot, double t_hadj, TextInfo &&t_text)
-        : col(t_col), pos(t_pos), rot(t_rot), hadj(t_hadj), str(t_str), text(t_text)
+    Page::Page(page_id_t t_id, gvertex<double> t_size)
+        : id(t_id), size(t_size)
     {
+        clip({0, 0, size.x, size.y});
     }
-    Circle::Circle(LineInfo &&t_line, color_t t_fill, gvertex<double> t_pos, double t_radius)
-        : line(t_line), fill(t_fill), pos(t_pos), radius(t_radius)
+
+    Page::Page(const Page &t_other)
+        : id(t_other.id),
+          size(t_other.size),
+          fill(t_other.fill),
+          dcs(t_other.dcs),
+          cps(t_other.cps),
+          dc_seq(t_other.dc_seq),
+          dc_seq_base(t_other.dc_seq_base),
+          version(t_other.version),
+          m_line_styles(t_other.m_line_styles),
+          m_text_styles(t_other.m_text_styles),
+          m_texts(t_other.m_texts),
+          m_circles(t_other.m_circles),
+          m_lines(t_other.m_lines),
+          m_rects(t_other.m_rects),
+          m_polys(t_other.m_polys),
+          m_rasters(t_other.m_rasters),
+          m_points(t_other.m_points),
+          m_nper(t_other.m_nper),
+          m_pixels(t_other.m_pixels),
+          m_index(std::atomic_load(&t_other.m_index))
     {
     }
-    Line::Line(LineInfo &&t_line, gvertex<double> t_orig, gvertex<double> t_dest)
-        : line(t_line), orig(t_orig), dest(t_dest)
+
+    Page &Page::operator=(const Page &t_other)
     {
+        if (this != &t_other)
+        {
+            *this = Page(t_other);
+        }
+        return *this;
     }
-    Rect::Rect(LineInfo &&t_line, color_t t_fill, grect<double> t_rect)
-        : line(t_line), fill(t_fill), rect(t_rect)
+
+    void Page::clip(grect<double> t_rect)
     {
+        const auto cps_count = cps.size();
+        if (cps_count == 0 || !cps.back().equals(t_rect))
+        {
+            cps.emplace_back(Clip(cps_count, t_rect));
+        }
+    }
+
+    void Page::m_put(DrawCallType t_type, std::size_t t_index)
+    {
+        dcs.push_back({t_type, cps.back().id, static_cast<std::uint32_t>(t_index)});
+        ++dc_seq;
+        m_index.reset();
+    }
+
+    Page::Range Page::m_put_points(int t_n, const double *t_x, const double *t_y)
+    {
+        const Range range{m_points.size(), static_cast<std::size_t>(t_n)};
+        m_points.reserve(m_points.size() + t_n);
+        for (int i = 0; i < t_n; ++i)
+        {
+            m_points.push_back({t_x[i], t_y[i]});
+        }
+        return range;
+    }
+
+    void Page::put_text(color_t t_col, gvertex<double> t_pos, std::string &&t_str, double t_rot, double t_hadj, TextInfo &&t_text, double t_txtwidth_px)
+    {
+        m_put(DrawCallType::TEXT, m_texts.size());
+        m_texts.push_back({t_col, t_pos, t_rot, t_hadj, std::move(t_str), m_text_styles.intern(std::move(t_text)), t_txtwidth_px});
+    }
+    void Page::put_circle(LineInfo &&t_line, color_t t_fill, gvertex<double> t_pos, double t_radius)
+    {
+        m_put(DrawCallType::CIRCLE, m_circles.size());
+        m_circles.push_back({m_line_styles.intern(std::move(t_line)), t_fill, t_pos, t_radius});
     }
-    Polyline::Polyline(LineInfo &&t_line, std::vector<gvertex<double>> &&t_points)
-        : line(t_line), points(t_points)
+    void Page::put_line(LineInfo &&t_line, gvertex<double> t_orig, gvertex<double> t_dest)
     {
+        m_put(DrawCallType::LINE, m_lines.size());
+        m_lines.push_back({m_line_styles.intern(std::move(t_line)), t_orig, t_dest});
     }
-    Polygon::Polygon(LineInfo &&t_line, color_t t_fill, std::vector<gvertex<double>> &&t_points)
-        : line(t_line), fill(t_fill), points(t_points)
+    void Page::put_rect(LineInfo &&t_line, color_t t_fill, grect<double> t_rect)
     {
+        m_put(DrawCallType::RECT, m_rects.size());
+        m_rects.push_back({m_line_styles.intern(std::move(t_line)), t_fill, t_rect});
     }
-    Path::Path(LineInfo &&t_line, color_t t_fill, std::vector<gvertex<double>> &&t_points, std::vector<int> &&t_nper, bool t_winding)
-        : line(t_line), fill(t_fill), points(t_points), nper(t_nper), winding(t_winding)
+    void Page::put_polyline(LineInfo &&t_line, int t_n, const double *t_x, const double *t_y)
     {
+        m_put(DrawCallType::POLYLINE, m_polys.size());
+        m_polys.push_back({m_line_styles.intern(std::move(t_line)), 0, m_put_points(t_n, t_x, t_y), {0, 0}, false});
     }
-    Raster::Raster(std::vector<unsigned int> &&t_raster, gvertex<int> t_wh,
-               grect<double> t_rect,
-               double t_rot,
-               bool t_interpolate)
-        : raster(t_raster), wh(t_wh), rect(t_rect), rot(t_rot), interpolate(t_interpolate)
+    void Page::put_polygon(LineInfo &&t_line, color_t t_fill, int t_n, const double *t_x, const double *t_y)
     {
+        m_put(DrawCallType::POLYGON, m_polys.size());
+        m_polys.push_back({m_line_styles.intern(std::move(t_line)), t_fill, m_put_points(t_n, t_x, t_y), {0, 0}, false});
     }
+    void Page::put_path(LineInfo &&t_line, color_t t_fill, int t_npoly, const int *t_nper, const double *t_x, const double *t_y, bool t_winding)
+    {
+        int npoints = 0;
+        for (int i = 0; i < t_npoly; ++i)
+        {
+            npoints += t_nper[i];
+        }
+        const Range nper{m_nper.size(), static_cast<std::size_t>(t_npoly)};
+        m_nper.insert(m_nper.end(), t_nper, t_nper + t_npoly);
 
-    Clip::Clip(clip_id_t t_id, grect<double> t_rect)
-        : id(t_id), rect(t_rect)
+        m_put(DrawCallType::PATH, m_polys.size());
+        m_polys.push_back({m_line_styles.intern(std::move(t_line)), t_fill, m_put_points(npoints, t_x, t_y), nper, t_winding});
+    }
+    void Page::put_raster(const unsigned int *t_raster, gvertex<int> t_wh, grect<double> t_rect, double t_rot, bool t_interpolate)
     {
+        const Range raster{m_pixels.size(), static_cast<std::size_t>(t_wh.x) * t_wh.y};
+        m_pixels.insert(m_pixels.end(), t_raster, t_raster + raster.count);
+
+        m_put(DrawCallType::RASTER, m_rasters.size());
+        // FNV-1a over the pixels, combined with what the encoded image depends on
+        std::uint64_t hash = 0xcbf29ce484222325;
+        for (std::size_t i = 0; i < raster.count; ++i)
+        {
+            hash = (hash ^ t_raster[i]) * 0x100000001b3;
+        }
+        std::size_t h = static_cast<std::size_t>(hash);
+        hash_combine(h, std::hash<int>{}(t_wh.x));
+        hash_combine(h, std::hash<int>{}(t_wh.y));
+        hash_combine(h, std::hash<double>{}(t_rect.width));
+        hash_combine(h, std::hash<double>{}(t_rect.height));
+        hash_combine(h, std::hash<bool>{}(t_interpolate));
+        m_rasters.push_back({raster, t_wh, t_rect, t_rot, t_interpolate, std::make_shared<RasterCache>(), h});
     }
-    
-    bool Clip::equals(grect<double> t_rect) const
+
+    void Page::render(const DrawCall &t_dc, Renderer *t_renderer) const
     {
-        return rect_equals(t_rect, rect, 0.01);
+        switch (t_dc.type)
+        {
+        case DrawCallType::TEXT:
+        {
+            const auto &text = m_texts[t_dc.index];
+            t_renderer->text({t_dc.clip_id, text.col, text.pos, text.rot, text.hadj, text.str,
+                              m_text_styles[text.text], text.text, text.txtwidth_px});
+            break;
+        }
+        case DrawCallType::CIRCLE:
+        {
+            const auto &circle = m_circles[t_dc.index];
+            t_renderer->circle({t_dc.clip_id, m_line_styles[circle.line], circle.line,
+                                circle.fill, circle.pos, circle.radius});
+            break;
+        }
+        case DrawCallType::LINE:
+        {
+            const auto &line = m_lines[t_dc.index];
+            t_renderer->line({t_dc.clip_id, m_line_styles[line.line], line.line,
+                              line.orig, line.dest});
+            break;
+        }
+        case DrawCallType::RECT:
+        {
+            const auto &rect = m_rects[t_dc.index];
+            t_renderer->rect({t_dc.clip_id, m_line_styles[rect.line], rect.line,
+                              rect.fill, rect.rect});
+            break;
+        }
+        case DrawCallType::POLYLINE:
+        {
+            const auto &poly = m_polys[t_dc.index];
+            t_renderer->polyline({t_dc.clip_id, m_line_styles[poly.line], poly.line,
+                                  {m_points.data() + poly.points.offset, poly.points.count}});
+            break;
+        }
+        case DrawCallType::POLYGON:
+        {
+            const auto &poly = m_polys[t_dc.index];
+            t_renderer->polygon({t_dc.clip_id, m_line_styles[poly.line], poly.line, poly.fill,
+                                 {m_points.data() + poly.points.offset, poly.points.count}});
+            break;
+        }
+        case DrawCallType::PATH:
+        {
+            const auto &poly = m_polys[t_dc.index];
+            t_renderer->path({t_dc.clip_id, m_line_styles[poly.line], poly.line, poly.fill,
+                              {m_points.data() + poly.points.offset, poly.points.count},
+                              {m_nper.data() + poly.nper.offset, poly.nper.count},
+                              poly.winding});
+            break;
+        }
+        case DrawCallType::RASTER:
+        {
+            const auto &raster = m_rasters[t_dc.index];
+            t_renderer->raster({t_dc.clip_id,
+                                {m_pixels.data() + raster.raster.offset, raster.raster.count},
+                                raster.wh, raster.rect, raster.rot, raster.interpolate, raster.cache.get(), raster.hash});
+            break;
+        }
+        default:
+            t_renderer->dc(t_dc);
+            break;
+        }
     }
 
-    Page::Page(page_id_t t_id, gvertex<double> t_size)
-        : id(t_id), size(t_size)
+    void Page::rescale(gvertex<double> t_size)
     {
-        clip({0, 0, size.x, size.y});
+        if (size.x <= 0 || size.y <= 0)
+        {
+            return;
+        }
+        const double fx = t_size.x / size.x;
+        const double fy = t_size.y / size.y;
+        const auto scale_pos = [&](gvertex<double> &t_pos) {
+            t_pos.x *= fx;
+            t_pos.y *= fy;
+        };
+        const auto scale_rect = [&](grect<double> &t_rect) {
+            t_rect.x *= fx;
+            t_rect.y *= fy;
+            t_rect.width *= fx;
+            t_rect.height *= fy;
+        };
+
+        for (auto &text : m_texts)
+        {
+            scale_pos(text.pos);
+        }
+        for (auto &circle : m_circles)
+        {
+            scale_pos(circle.pos);
+        }
+        for (auto &line : m_lines)
+        {
+            scale_pos(line.orig);
+            scale_pos(line.dest);
+        }
+        for (auto &rect : m_rects)
+        {
+            scale_rect(rect.rect);
+        }
+        for (auto &point : m_points)
+        {
+            scale_pos(point);
+        }
+        for (auto &raster : m_rasters)
+        {
+            scale_rect(raster.rect);
+        }
+        for (auto &clip : cps)
+        {
+            scale_rect(clip.rect);
+        }
+        size = t_size;
+        m_index.reset();
     }
 
-    void Page::clip(grect<double> t_rect)
+    std::vector<DrawCall> Page::query(grect<double> t_rect) const
     {
-        const auto cps_count = cps.size();
-        if (cps_count == 0 || !cps.back().equals(t_rect))
+        auto index = std::atomic_load(&m_index);
+        if (!index)
         {
-            cps.emplace_back(Clip(cps_count, t_rect));
+            // concurrent renders may build it twice, which is harmless
+            index = std::make_shared<const SpatialIndex>(*this);
+            std::atomic_store(&m_index, index);
         }
+        return index->query(*this, t_rect);
+    }
+
+    template <typename T>
+    static std::size_t buffer_bytes(const std::vector<T> &t_buffer)
+    {
+        return t_buffer.capacity() * sizeof(T);
+    }
+
+    std::size_t Page::bytes() const
+    {
+        std::size_t n = sizeof(Page) +
+                        buffer_bytes(dcs) + buffer_bytes(cps) +
+                        buffer_bytes(m_texts) + buffer_bytes(m_circles) +
+                        buffer_bytes(m_lines) + buffer_bytes(m_rects) +
+                        buffer_bytes(m_polys) + buffer_bytes(m_rasters) +
+                        buffer_bytes(m_points) + buffer_bytes(m_nper) +
+                        buffer_bytes(m_pixels);
+        for (const auto &text : m_texts)
+        {
+            n += text.str.capacity();
+        }
+        return n;
+    }
+
+    const std::vector<LineInfo> &Page::line_styles() const
+    {
+        return m_line_styles.styles();
+    }
+    const std::vector<TextInfo> &Page::text_styles() const
+    {
+        return m_text_styles.styles();
     }
 
-    void Page::put(std::shared_ptr<DrawCall> t_dc)
+    bool Page::has_dcs_since(std::uint64_t t_seq) const
     {
-        dcs.emplace_back(t_dc);
-        t_dc->clip_id = cps.back().id;
+        return t_seq >= dc_seq_base && t_seq <= dc_seq;
     }
 
     void Page::clear()
     {
+        dc_seq_base = ++dc_seq;
         dcs.clear();
         cps.clear();
+        m_line_styles.clear();
+        m_text_styles.clear();
+        m_texts.clear();
+        m_circles.clear();
+        m_lines.clear();
+        m_rects.clear();
+        m_polys.clear();
+        m_rasters.clear();
+        m_points.clear();
+        m_nper.clear();
+        m_pixels.clear();
+        m_index.reset();
         clip({0, 0, size.x, size.y});
     }
 
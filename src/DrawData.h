@@ -3,8 +3,13 @@
 
 #include "HttpgdGeom.h"
 
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // Do not include any R headers here !
@@ -88,6 +93,12 @@ namespace httpgd::dc
         GC_lineend lend;
         GC_linejoin ljoin;
         double lmitre;
+
+        bool operator==(const LineInfo &t_other) const;
+    };
+    struct LineInfoHash
+    {
+        std::size_t operator()(const LineInfo &t_line) const;
     };
 
     struct TextInfo
@@ -97,116 +108,230 @@ namespace httpgd::dc
         std::string font_family;
         double fontsize;
         bool italic;
-        double txtwidth_px;
+
+        bool operator==(const TextInfo &t_other) const;
+    };
+    struct TextInfoHash
+    {
+        std::size_t operator()(const TextInfo &t_text) const;
     };
 
     // Draw calls
 
-    class Renderer;
+    /**
+     * Read-only view of a contiguous range of a page buffer.
+     * Only valid as long as the page is not modified.
+     */
+    template <typename T>
+    class Span
+    {
+    public:
+        Span(const T *t_data, std::size_t t_size)
+            : m_data(t_data), m_size(t_size)
+        {
+        }
+
+        [[nodiscard]] const T *begin() const { return m_data; }
+        [[nodiscard]] const T *end() const { return m_data + m_size; }
+        [[nodiscard]] const T *data() const { return m_data; }
+        [[nodiscard]] std::size_t size() const { return m_size; }
+        [[nodiscard]] bool empty() const { return m_size == 0; }
+        const T &operator[](std::size_t t_i) const { return m_data[t_i]; }
 
-    class Clip;
+    private:
+        const T *m_data;
+        std::size_t m_size;
+    };
+
+    using style_id_t = std::uint32_t;
 
-    class DrawCall
+    /**
+     * Interns equal styles, so that draw calls only need to store
+     * a small id. Typical plots only use a handful of distinct styles.
+     */
+    template <typename T, typename Hash>
+    class StyleTable
     {
     public:
-        virtual ~DrawCall() = default; 
-        virtual void render(Renderer *t_renderer) const;
+        style_id_t intern(T &&t_style)
+        {
+            // consecutive draw calls often share their style
+            if (!m_styles.empty() && m_styles[m_last] == t_style)
+            {
+                return m_last;
+            }
+            const std::size_t hash = Hash{}(t_style);
+            const auto range = m_lookup.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if (m_styles[it->second] == t_style)
+                {
+                    m_last = it->second;
+                    return m_last;
+                }
+            }
+            m_last = static_cast<style_id_t>(m_styles.size());
+            m_styles.push_back(std::move(t_style));
+            m_lookup.emplace(hash, m_last);
+            return m_last;
+        }
+
+        const T &operator[](style_id_t t_id) const
+        {
+            return m_styles[t_id];
+        }
+
+        [[nodiscard]] const std::vector<T> &styles() const
+        {
+            return m_styles;
+        }
+
+        void clear()
+        {
+            m_styles.clear();
+            m_lookup.clear();
+            m_last = 0;
+        }
 
-        clip_id_t clip_id = 0;
+    private:
+        std::vector<T> m_styles;
+        std::unordered_multimap<std::size_t, style_id_t> m_lookup;
+        style_id_t m_last = 0;
     };
 
-    class Text : public DrawCall
+    enum class DrawCallType : std::uint8_t
     {
-    public:
-        Text(color_t t_col, gvertex<double> t_pos, std::string &&t_str, double t_rot, double t_hadj, TextInfo &&t_text);
-        void render(Renderer *t_renderer) const override;
+        TEXT,
+        CIRCLE,
+        LINE,
+        RECT,
+        POLYLINE,
+        POLYGON,
+        PATH,
+        RASTER
+    };
 
+    /**
+     * Entry of the draw call list of a page. The actual draw call data
+     * lives in the page buffers of the respective type (at index).
+     */
+    struct DrawCall
+    {
+        DrawCallType type;
+        clip_id_t clip_id;
+        std::uint32_t index;
+    };
+
+    // The following are views into the page buffers and style tables,
+    // they are created on the fly while rendering.
+
+    struct Text
+    {
+        clip_id_t clip_id;
         color_t col;
         gvertex<double> pos;
         double rot, hadj;
-        std::string str;
-        TextInfo text;
+        const std::string &str;
+        const TextInfo &text;
+        style_id_t text_id;
+        double txtwidth_px;
     };
 
-    class Circle : public DrawCall
+    struct Circle
     {
-    public:
-        Circle(LineInfo &&t_line, color_t t_fill, gvertex<double> t_pos, double t_radius);
-        void render(Renderer *t_renderer) const override;
-
-        LineInfo line;
+        clip_id_t clip_id;
+        const LineInfo &line;
+        style_id_t line_id;
         color_t fill;
         gvertex<double> pos;
         double radius;
     };
 
-    class Line : public DrawCall
+    struct Line
     {
-    public:
-        Line(LineInfo &&t_line, gvertex<double> t_orig, gvertex<double> t_dest);
-        void render(Renderer *t_renderer) const override;
-
-        LineInfo line;
+        clip_id_t clip_id;
+        const LineInfo &line;
+        style_id_t line_id;
         gvertex<double> orig, dest;
     };
 
-    class Rect : public DrawCall
+    struct Rect
     {
-    public:
-        Rect(LineInfo &&t_line, color_t t_fill, grect<double> t_rect);
-        void render(Renderer *t_renderer) const override;
-
-        LineInfo line;
+        clip_id_t clip_id;
+        const LineInfo &line;
+        style_id_t line_id;
         color_t fill;
         grect<double> rect;
     };
 
-    class Polyline : public DrawCall
+    struct Polyline
     {
-    public:
-        Polyline(LineInfo &&t_line, std::vector<gvertex<double>> &&t_points);
-        void render(Renderer *t_renderer) const override;
-
-        LineInfo line;
-        std::vector<gvertex<double>> points;
+        clip_id_t clip_id;
+        const LineInfo &line;
+        style_id_t line_id;
+        Span<gvertex<double>> points;
     };
-    class Polygon : public DrawCall
-    {
-    public:
-        Polygon(LineInfo &&t_line, color_t t_fill, std::vector<gvertex<double>> &&t_points);
-        void render(Renderer *t_renderer) const override;
 
-        LineInfo line;
+    struct Polygon
+    {
+        clip_id_t clip_id;
+        const LineInfo &line;
+        style_id_t line_id;
         color_t fill;
-        std::vector<gvertex<double>> points;
+        Span<gvertex<double>> points;
     };
-    class Path : public DrawCall
-    {
-    public:
-        Path(LineInfo &&t_line, color_t t_fill, std::vector<gvertex<double>> &&t_points, std::vector<int> &&t_nper, bool t_winding);
-        void render(Renderer *t_renderer) const override;
 
-        LineInfo line;
+    struct Path
+    {
+        clip_id_t clip_id;
+        const LineInfo &line;
+        style_id_t line_id;
         color_t fill;
-        std::vector<gvertex<double>> points;
-        std::vector<int> nper;
+        Span<gvertex<double>> points;
+        Span<int> nper;
         bool winding;
     };
 
-    class Raster : public DrawCall
+    /**
+     * Memoized encoding (PNG/base64) of a raster image, keyed by the pixel
+     * size of the encoded image (rasters are upscaled to their target
+     * size) and the PNG compression mode. Keeps the few most recently
+     * used encodings, so clients viewing the plot in different sizes do
+     * not evict each other. Shared by all copies of the page, renders on
+     * several threads may read and fill it at once.
+     */
+    class RasterCache
     {
     public:
-        Raster(std::vector<unsigned int> &&t_raster, gvertex<int> t_wh,
-               grect<double> t_rect,
-               double t_rot,
-               bool t_interpolate);
-        void render(Renderer *t_renderer) const override;
+        // nullptr if the image has not been encoded like this yet
+        [[nodiscard]] std::shared_ptr<const std::string> get(gvertex<int> t_size, bool t_fast) const;
+        void put(gvertex<int> t_size, bool t_fast, std::shared_ptr<const std::string> t_encoded);
+
+    private:
+        static constexpr std::size_t max_entries = 4;
+        static constexpr std::size_t max_bytes = 16 * 1024 * 1024; // 16 MiB
 
-        std::vector<unsigned int> raster;
+        struct Entry
+        {
+            gvertex<int> size;
+            bool fast;
+            std::shared_ptr<const std::string> encoded;
+        };
+        mutable std::mutex m_mutex;
+        mutable std::vector<Entry> m_entries; // most recently used first
+    };
+
+    struct Raster
+    {
+        clip_id_t clip_id;
+        Span<unsigned int> raster;
         gvertex<int> wh;
         grect<double> rect;
         double rot;
         bool interpolate;
+        RasterCache *cache;
+        // Identifies the image (pixels and target size) within the page
+        std::uint64_t hash;
     };
 
     class Clip
@@ -219,20 +344,148 @@ namespace httpgd::dc
         grect<double> rect;
     };
 
+    class Renderer;
+    class SpatialIndex;
+
+    /**
+     * Draw calls are stored in flat per-type buffers owned by the page,
+     * point lists and raster images are appended to shared contiguous
+     * buffers. dcs lists the draw calls in drawing order. Line and text
+     * styles are interned in per-page style tables.
+     */
     class Page
     {
     public:
         Page(page_id_t t_id, gvertex<double> t_size);
-        void put(std::shared_ptr<DrawCall> t_dc);
+        // Copies may be taken while other threads query() the page, so
+        // the spatial index is loaded atomically.
+        Page(const Page &t_other);
+        Page(Page &&) = default;
+        Page &operator=(const Page &t_other);
+        Page &operator=(Page &&) = default;
         void clear();
         void clip(grect<double> t_rect);
 
+        void put_text(color_t t_col, gvertex<double> t_pos, std::string &&t_str, double t_rot, double t_hadj, TextInfo &&t_text, double t_txtwidth_px);
+        void put_circle(LineInfo &&t_line, color_t t_fill, gvertex<double> t_pos, double t_radius);
+        void put_line(LineInfo &&t_line, gvertex<double> t_orig, gvertex<double> t_dest);
+        void put_rect(LineInfo &&t_line, color_t t_fill, grect<double> t_rect);
+        void put_polyline(LineInfo &&t_line, int t_n, const double *t_x, const double *t_y);
+        void put_polygon(LineInfo &&t_line, color_t t_fill, int t_n, const double *t_x, const double *t_y);
+        void put_path(LineInfo &&t_line, color_t t_fill, int t_npoly, const int *t_nper, const double *t_x, const double *t_y, bool t_winding);
+        void put_raster(const unsigned int *t_raster, gvertex<int> t_wh, grect<double> t_rect, double t_rot, bool t_interpolate);
+
+        // Scales all positions (and rect, polygon and raster extents) to a
+        // new page size. Text and symbol sizes and line widths are kept,
+        // so the result approximates replaying the plot in that size.
+        void rescale(gvertex<double> t_size);
+
+        // dispatch draw call to the matching renderer method
+        void render(const DrawCall &t_dc, Renderer *t_renderer) const;
+
+        // Draw calls that intersect t_rect (page units), in drawing order.
+        // Builds a spatial index of the page on first use.
+        [[nodiscard]] std::vector<DrawCall> query(grect<double> t_rect) const;
+
+        // true if the draw calls appended after sequence number t_seq
+        // are still stored in dcs (page was not cleared since then)
+        [[nodiscard]] bool has_dcs_since(std::uint64_t t_seq) const;
+
+        // Approximate memory held by the draw call buffers (bytes).
+        [[nodiscard]] std::size_t bytes() const;
+
+        [[nodiscard]] const std::vector<LineInfo> &line_styles() const;
+        [[nodiscard]] const std::vector<TextInfo> &text_styles() const;
+
         page_id_t id;
         gvertex<double> size;
         color_t fill;
 
-        std::vector<std::shared_ptr<DrawCall>> dcs;
+        std::vector<DrawCall> dcs;
         std::vector<Clip> cps;
+
+        // Draw call sequence numbers: dcs[i] has the sequence number
+        // dc_seq_base + i + 1, dc_seq is the number of the last draw call.
+        // Clearing the page skips a number, so clients that know an older
+        // version of the page can tell that it has been reset.
+        std::uint64_t dc_seq = 0;
+        std::uint64_t dc_seq_base = 0;
+
+        // Set by the data store whenever the page (or its size) changes.
+        std::uint64_t version = 0;
+
+    private:
+        struct Range
+        {
+            std::size_t offset;
+            std::size_t count;
+        };
+        struct TextData
+        {
+            color_t col;
+            gvertex<double> pos;
+            double rot, hadj;
+            std::string str;
+            style_id_t text;
+            double txtwidth_px;
+        };
+        struct CircleData
+        {
+            style_id_t line;
+            color_t fill;
+            gvertex<double> pos;
+            double radius;
+        };
+        struct LineData
+        {
+            style_id_t line;
+            gvertex<double> orig, dest;
+        };
+        struct RectData
+        {
+            style_id_t line;
+            color_t fill;
+            grect<double> rect;
+        };
+        struct PolyData
+        {
+            style_id_t line;
+            color_t fill;
+            Range points;
+            Range nper;
+            bool winding;
+        };
+        struct RasterData
+        {
+            Range raster;
+            gvertex<int> wh;
+            grect<double> rect;
+            double rot;
+            bool interpolate;
+            std::shared_ptr<RasterCache> cache;
+            std::uint64_t hash;
+        };
+
+        StyleTable<LineInfo, LineInfoHash> m_line_styles;
+        StyleTable<TextInfo, TextInfoHash> m_text_styles;
+
+        std::vector<TextData> m_texts;
+        std::vector<CircleData> m_circles;
+        std::vector<LineData> m_lines;
+        std::vector<RectData> m_rects;
+        std::vector<PolyData> m_polys;
+        std::vector<RasterData> m_rasters;
+
+        std::vector<gvertex<double>> m_points;
+        std::vector<int> m_nper;
+        std::vector<unsigned int> m_pixels;
+
+        // Built lazily by query() (possibly from several render threads
+        // at once), reset whenever draw calls change.
+        mutable std::shared_ptr<const SpatialIndex> m_index;
+
+        void m_put(DrawCallType t_type, std::size_t t_index);
+        Range m_put_points(int t_n, const double *t_x, const double *t_y);
     };
 
     class Renderer
@@ -243,40 +496,74 @@ namespace httpgd::dc
         virtual void page(const Page &t_page)
         {
         }
+        // unknown draw call type
         virtual void dc(const DrawCall &t_dc)
         {
         }
         virtual void rect(const Rect &t_rect)
         {
-            dc(t_rect);
         }
         virtual void text(const Text &t_text)
         {
-            dc(t_text);
         }
         virtual void circle(const Circle &t_circle)
         {
-            dc(t_circle);
         }
         virtual void line(const Line &t_line)
         {
-            dc(t_line);
         }
         virtual void polyline(const Polyline &t_polyline)
         {
-            dc(t_polyline);
         }
         virtual void polygon(const Polygon &t_polygon)
         {
-            dc(t_polygon);
         }
         virtual void path(const Path &t_path)
         {
-            dc(t_path);
         }
         virtual void raster(const Raster &t_raster)
         {
-            dc(t_raster);
+        }
+    };
+
+    // Per request output options of the text renderers.
+    struct RenderOptions
+    {
+        // Decimals of coordinates and lengths (0-4)
+        int precision = 2;
+        // SVG: Write coordinates and lengths as integers in units of
+        // 10^-precision and scale the viewBox instead.
+        bool integer_coords = false;
+        // Reduce polylines, polygons and paths to what is visible at this
+        // resolution (in output pixels), 0: off
+        double simplify = 0;
+        // Leave out circles and rects that are clipped away or hidden
+        // under an identical shape at this resolution.
+        bool cull = false;
+        // SVG: If the page has more draw calls than this, long runs of
+        // non-text draw calls in one clip region are embedded as PNG
+        // images instead (0: off).
+        std::size_t raster_threshold = 0;
+        // Only render the draw calls that are visible in this rectangle
+        // (page units), the output covers the rectangle instead of the page.
+        boost::optional<grect<double>> viewport;
+        // Encode embedded PNG images (rasters) with fast filtering and low
+        // compression: larger, but much quicker to write (on-screen use).
+        bool fast_png = false;
+        // SVG: Link raster images as <raster_url>id=<page id>&hash=<hash>
+        // instead of embedding them as data URIs (empty: embed).
+        std::string raster_url;
+
+        bool operator==(const RenderOptions &t_other) const
+        {
+            return precision == t_other.precision && integer_coords == t_other.integer_coords &&
+                   simplify == t_other.simplify && cull == t_other.cull &&
+                   raster_threshold == t_other.raster_threshold && fast_png == t_other.fast_png &&
+                   raster_url == t_other.raster_url &&
+                   viewport.has_value() == t_other.viewport.has_value() &&
+                   (!viewport || (viewport->x == t_other.viewport->x && viewport->y == t_other.viewport->y &&
+                                  viewport->width == t_other.viewport->width &&
+                                  viewport->height == t_other.viewport->height));
         }
     };
 
@@ -292,12 +579,53 @@ namespace httpgd::dc
     class StringRenderingTarget : virtual public RenderingTarget
     {
     public:
+        using sink_t = std::function<void(const char *, std::size_t)>;
+
         virtual ~StringRenderingTarget() = default;
         [[nodiscard]] 
         virtual std::string get_string() const
         {
             return std::string("");
         }
+        // Moves the output out of the renderer (it is empty afterwards),
+        // use instead of get_string() to avoid copying large outputs.
+        virtual std::string take_string()
+        {
+            return get_string();
+        }
+
+        // Renderers that support it pass their output to t_sink in pieces
+        // of about t_chunk_size bytes while rendering. get_string() then
+        // only returns the output that has not been passed on yet.
+        void stream(sink_t t_sink, std::size_t t_chunk_size)
+        {
+            m_sink = std::move(t_sink);
+            m_chunk_size = t_chunk_size;
+        }
+
+    protected:
+        sink_t m_sink;
+        std::size_t m_chunk_size = 0; // 0: keep everything
+
+        // Called between draw calls (and with t_force once the page is
+        // complete) by streaming renderers.
+        template <typename Buffer>
+        void m_drain(Buffer &t_os, bool t_force)
+        {
+            if (m_chunk_size == 0 || (!t_force && t_os.size() < m_chunk_size))
+            {
+                return;
+            }
+            m_flush(t_os.data(), t_os.size());
+            t_os.clear();
+        }
+        virtual void m_flush(const char *t_data, std::size_t t_size)
+        {
+            if (m_sink)
+            {
+                m_sink(t_data, t_size);
+            }
+        }
     };
     class BinaryRenderingTarget : virtual public RenderingTarget
     {
@@ -308,6 +636,11 @@ namespace httpgd::dc
         {
             return {};
         }
+        // see StringRenderingTarget::take_string()
+        virtual std::vector<unsigned char> take_binary()
+        {
+            return get_binary();
+        }
     };
 
 } // namespace httpgd::dc
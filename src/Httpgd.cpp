@@ -10,6 +10,8 @@
 
 //#include <R_ext/GraphicsEngine.h>
 
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include <string>
 
@@ -48,7 +50,8 @@ namespace httpgd
 bool httpgd_(std::string host, int port, std::string bg, double width, double height,
              double pointsize, cpp11::list aliases, bool cors, std::string token, 
              bool webserver, bool silent, bool fix_text_width, std::string extra_css,
-             bool reset_par)
+             bool reset_par, int threads, int update_interval,
+             int compression_level, int compression_min_size)
 {
     bool recording = true;
     bool use_token = token.length();
@@ -72,7 +75,11 @@ bool httpgd_(std::string host, int port, std::string bg, double width, double he
          recording,
          webserver,
          silent,
-         httpgd::rng::uuid()},
+         httpgd::rng::uuid(),
+         threads,
+         update_interval,
+         compression_level,
+         compression_min_size},
         {ibg,
          width,
          height,
@@ -147,6 +154,7 @@ cpp11::list httpgd_info_(int devnum)
     auto dev = validate_httpgddev(devnum);
 
     auto svr_config = dev->api_server_config();
+    const auto cache = dev->cache_stats();
 
     using namespace cpp11::literals;
     return cpp11::writable::list{
@@ -155,6 +163,13 @@ cpp11::list httpgd_info_(int devnum)
         "httpgd"_nm = HTTPGD_VERSION,
         "boost"_nm = HTTPGD_VERSION_BOOST,
         "cairo"_nm = HTTPGD_VERSION_CAIRO
+        },
+        "cache"_nm = cpp11::writable::list{
+        "entries"_nm = static_cast<double>(cache.entries),
+        "bytes"_nm = static_cast<double>(cache.bytes),
+        "capacity"_nm = static_cast<double>(cache.capacity),
+        "hits"_nm = static_cast<double>(cache.hits),
+        "misses"_nm = static_cast<double>(cache.misses)
         }
     };
 }
@@ -249,7 +264,7 @@ int httpgd_plot_find_(int devnum, std::string plot_id)
 }
 
 [[cpp11::register]]
-std::string httpgd_plot_str_(int devnum, int page, double width, double height, double zoom, std::string renderer_id)
+cpp11::strings httpgd_plot_str_(int devnum, int page, double width, double height, double zoom, std::string renderer_id, int raster_threshold)
 {
     auto dev = validate_httpgddev(devnum);
 
@@ -263,13 +278,24 @@ std::string httpgd_plot_str_(int devnum, int page, double width, double height,
     {
         cpp11::stop("Not a valid string renderer ID.");
     }
-    auto renderer = (*fi_renderer).renderer();
-    dev->api_render(page, width / zoom, height / zoom, renderer.get(), zoom);
-    return renderer->get_string();
+    httpgd::dc::RenderOptions options;
+    options.raster_threshold = raster_threshold > 0 ? static_cast<std::size_t>(raster_threshold) : 0;
+    auto rendered = dev->api_render_string(page, width / zoom, height / zoom, *fi_renderer, zoom, options);
+    if (!rendered)
+    {
+        return cpp11::strings(cpp11::as_sexp(""));
+    }
+    if (rendered->size() > static_cast<std::size_t>(std::numeric_limits<int>::max()))
+    {
+        cpp11::stop("Rendered plot is too large for an R character string (more than 2 GiB).");
+    }
+    // create the R string directly from the (possibly cached) render
+    return cpp11::strings(cpp11::safe[Rf_ScalarString](
+        cpp11::safe[Rf_mkCharLenCE](rendered->data(), static_cast<int>(rendered->size()), CE_UTF8)));
 }
 
 [[cpp11::register]]
-cpp11::raws httpgd_plot_raw_(int devnum, int page, double width, double height, double zoom, std::string renderer_id)
+cpp11::raws httpgd_plot_raw_(int devnum, int page, double width, double height, double zoom, std::string renderer_id, int raster_threshold)
 {
     auto dev = validate_httpgddev(devnum);
 
@@ -283,11 +309,15 @@ cpp11::raws httpgd_plot_raw_(int devnum, int page, double width, double height,
     {
         cpp11::stop("Not a valid binary renderer ID.");
     }
-    auto renderer = (*fi_renderer).renderer();
-    dev->api_render(page, width / zoom, height / zoom, renderer.get(), zoom);
-
-    auto bin = renderer->get_binary();
-    cpp11::writable::raws raw(bin.begin(), bin.end());
+    httpgd::dc::RenderOptions options;
+    options.raster_threshold = raster_threshold > 0 ? static_cast<std::size_t>(raster_threshold) : 0;
+    auto rendered = dev->api_render_binary(page, width / zoom, height / zoom, *fi_renderer, zoom, options);
+    if (!rendered)
+    {
+        return cpp11::writable::raws();
+    }
+    cpp11::writable::raws raw(static_cast<R_xlen_t>(rendered->size()));
+    std::copy(rendered->begin(), rendered->end(), RAW(raw));
     return raw;
 }
 
@@ -7,6 +7,7 @@
 #include <boost/optional.hpp>
 #include "HttpgdCommons.h"
 #include "DrawData.h"
+#include "RendererManager.h"
 
 namespace httpgd
 {
@@ -19,7 +20,17 @@ namespace httpgd
         virtual bool api_clear() = 0;
 
         virtual bool api_render(int index, double width, double height, dc::RenderingTarget *t_renderer, double t_scale) = 0;
+        virtual std::shared_ptr<const std::string> api_render_string(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options) = 0;
+        virtual std::shared_ptr<const std::vector<unsigned char>> api_render_binary(int index, double width, double height, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options) = 0;
         virtual boost::optional<int> api_index(int32_t id) = 0;
+        // Only returns a version if the page would not need to be replayed
+        // in the requested size.
+        virtual boost::optional<HttpgdPageVersion> api_version(int index, double width, double height) = 0;
+        // PNG image of the raster draw call or dense layer with this hash
+        // (in the page as it is currently stored), nullptr if there is none.
+        // Layers are rendered with this scale and the cull and viewport
+        // options, raster draw calls are encoded with options.fast_png.
+        virtual std::shared_ptr<const std::vector<unsigned char>> api_raster(int index, std::uint64_t hash, double scale, const dc::RenderOptions &options) = 0;
         
 
         virtual HttpgdState api_state() = 0;
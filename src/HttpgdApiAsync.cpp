@@ -1,6 +1,9 @@
 #include "RThread.h"
 #include "HttpgdApiAsync.h"
 
+#include <chrono>
+#include <cmath>
+
 namespace httpgd
 {
 
@@ -57,23 +60,273 @@ namespace httpgd
 
     void HttpgdApiAsync::api_prerender(int index, double width, double height)
     {
+        m_replay(index, {width, height});
+    }
+
+    std::shared_ptr<std::shared_mutex> HttpgdApiAsync::m_page_lock(int index)
+    {
+        const auto query = m_data_store->query_index(index);
+        if (query.ids.empty())
+        {
+            return nullptr;
+        }
+        const std::lock_guard<std::mutex> lock(m_page_locks_mutex);
+        auto &page_lock = m_page_locks[query.ids.front()];
+        if (!page_lock)
+        {
+            // drop the locks of pages nobody renders right now
+            for (auto it = m_page_locks.begin(); it != m_page_locks.end();)
+            {
+                it = (it->second && it->second.use_count() == 1) ? m_page_locks.erase(it) : std::next(it);
+            }
+            page_lock = std::make_shared<std::shared_mutex>();
+        }
+        return page_lock;
+    }
+
+    std::shared_ptr<const dc::Page> HttpgdApiAsync::m_replay(int index, gvertex<double> t_size)
+    {
+        const auto page_lock = m_page_lock(index);
+        if (!page_lock)
+        {
+            return nullptr;
+        }
+        {
+            const std::lock_guard<std::shared_mutex> lock(*page_lock);
+            if (m_data_store->restore(index, t_size)) 
+            {
+                return m_data_store->snapshot(index); // no need to bother R
+            }
+        }
+
         const std::lock_guard<std::mutex> lock(m_rdevice_alive_mutex);
         if (!m_rdevice_alive)
-            return;
+            return nullptr;
 
-        async::r_thread([&](){
-            this->m_rdevice->api_prerender(index, width, height);
-        }).wait();        
+        try {
+            // The page is locked by the R thread itself, so it is not
+            // locked while waiting for R to become idle.
+            return async::r_thread([&](){
+                const std::lock_guard<std::shared_mutex> lock(*page_lock);
+                if (m_data_store->diff(index, t_size))
+                {
+                    this->m_rdevice->api_prerender(index, t_size.x, t_size.y);
+                }
+                return m_data_store->snapshot(index);
+            }).get();
+        } catch (...) {}
+        return nullptr;
+    }
+    
+    template <typename F>
+    auto HttpgdApiAsync::m_render_sized(int index, double width, double height, F &&t_render)
+    {
+        std::shared_ptr<const dc::Page> page;
+        if (const auto page_lock = m_page_lock(index))
+        {
+            const std::shared_lock<std::shared_mutex> lock(*page_lock);
+            if (!m_data_store->diff(index, {width, height}))
+            {
+                page = m_data_store->snapshot(index);
+            }
+        }
+        if (!page)
+        {
+            // the snapshot taken right after the replay, so no other
+            // request can resize the page in between
+            page = m_replay(index, {width, height});
+        }
+        return t_render(page);
     }
     
     bool HttpgdApiAsync::api_render(int index, double width, double height, dc::RenderingTarget *t_renderer, double t_scale) 
     {
-        if (m_data_store->diff(index, {width, height}))
+        return m_render_sized(index, width, height, [&](const std::shared_ptr<const dc::Page> &t_page) {
+            return m_data_store->render(t_page, t_renderer, t_scale);
+        });
+    }
+
+    std::shared_ptr<const std::string> HttpgdApiAsync::api_render_string(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        return m_render_sized(index, width, height, [&](const std::shared_ptr<const dc::Page> &t_page) {
+            return m_data_store->render_string(t_page, t_renderer, t_scale, t_options);
+        });
+    }
+
+    std::shared_ptr<const std::string> HttpgdApiAsync::api_render_string(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options,
+                                                                         const dc::StringRenderingTarget::sink_t &t_sink, std::size_t t_chunk_size)
+    {
+        return m_render_sized(index, width, height, [&](const std::shared_ptr<const dc::Page> &t_page) {
+            return m_data_store->render_string(t_page, t_renderer, t_scale, t_options, t_sink, t_chunk_size);
+        });
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdApiAsync::api_render_binary(int index, double width, double height, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        return m_render_sized(index, width, height, [&](const std::shared_ptr<const dc::Page> &t_page) {
+            return m_data_store->render_binary(t_page, t_renderer, t_scale, t_options);
+        });
+    }
+
+    // R picks up tasks almost immediately when it is idle
+    constexpr auto r_idle_timeout = std::chrono::milliseconds(50);
+
+    template <typename F, typename G>
+    auto HttpgdApiAsync::m_render_provisional(int index, double width, double height, bool &t_provisional, F &&t_render, G &&t_render_page)
+    {
+        t_provisional = false;
+        const gvertex<double> size{width, height};
+        const auto page_lock = m_page_lock(index);
+        if (!page_lock || !m_data_store->diff(index, size))
+        {
+            return m_render_sized(index, width, height, t_render);
+        }
         {
-            api_prerender(index, width, height); // use async render call
-            // todo perform sync diff again and sync render svg
+            const std::lock_guard<std::shared_mutex> lock(*page_lock);
+            if (m_data_store->restore(index, size))
+            {
+                return t_render(m_data_store->snapshot(index));
+            }
+        }
+
+        // No need to lock the page: The scaled copy is taken from a
+        // snapshot, a replay in progress at worst shows up as an
+        // incomplete (provisional) plot.
+        const auto page = m_data_store->scaled(index, size);
+        if (!page)
+        {
+            return m_render_sized(index, width, height, t_render);
+        }
+        if (const auto replay = m_schedule_replay(page->id, page->size))
+        {
+            std::unique_lock<std::mutex> lock(replay->mutex);
+            // no need to wait if an earlier request already found R busy
+            if (!replay->abandoned && replay->cv.wait_for(lock, r_idle_timeout, [&]() { return replay->started; }))
+            {
+                // R is idle, wait for the exact replay
+                replay->cv.wait(lock, [&]() { return replay->done; });
+                const auto &exact = replay->page;
+                if (exact && std::fabs(exact->size.x - page->size.x) < 0.1 && std::fabs(exact->size.y - page->size.y) < 0.1)
+                {
+                    return t_render(exact);
+                }
+            }
+            else
+            {
+                replay->abandoned = true;
+            }
+        }
+        t_provisional = true;
+        return t_render_page(*page);
+    }
+
+    std::shared_ptr<const std::string> HttpgdApiAsync::api_render_string_provisional(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options, bool &t_provisional)
+    {
+        return m_render_provisional(
+            index, width, height, t_provisional,
+            [&](const std::shared_ptr<const dc::Page> &t_page) {
+                return m_data_store->render_string(t_page, t_renderer, t_scale, t_options);
+            },
+            [&](const dc::Page &t_page) {
+                auto renderer = t_renderer.renderer(t_options);
+                renderer->render(t_page, std::fabs(t_scale));
+                return std::make_shared<const std::string>(renderer->take_string());
+            });
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdApiAsync::api_render_binary_provisional(int index, double width, double height, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options, bool &t_provisional)
+    {
+        return m_render_provisional(
+            index, width, height, t_provisional,
+            [&](const std::shared_ptr<const dc::Page> &t_page) {
+                return m_data_store->render_binary(t_page, t_renderer, t_scale, t_options);
+            },
+            [&](const dc::Page &t_page) {
+                auto renderer = t_renderer.renderer(t_options);
+                renderer->render(t_page, std::fabs(t_scale));
+                return std::make_shared<const std::vector<unsigned char>>(renderer->take_binary());
+            });
+    }
+
+    std::shared_ptr<HttpgdApiAsync::DeferredReplay> HttpgdApiAsync::m_schedule_replay(page_id_t t_id, gvertex<double> t_size)
+    {
+        std::shared_ptr<DeferredReplay> replay;
+        {
+            const std::lock_guard<std::mutex> lock(m_deferred_mutex);
+            if (m_deferred_stopped)
+            {
+                return nullptr;
+            }
+            auto &pending = m_deferred_replays[t_id];
+            if (pending)
+            {
+                pending->size = t_size; // still queued, R is busy
+                return pending;
+            }
+            pending = std::make_shared<DeferredReplay>();
+            pending->size = t_size;
+            replay = pending;
+        }
+        // the task must not keep the device alive
+        async::r_thread([weak = weak_from_this(), t_id, replay]() {
+            if (const auto self = weak.lock())
+            {
+                self->m_run_deferred_replay(t_id, replay);
+            }
+        });
+        return replay;
+    }
+
+    void HttpgdApiAsync::m_run_deferred_replay(page_id_t t_id, const std::shared_ptr<DeferredReplay> &t_replay)
+    {
+        gvertex<double> size;
+        {
+            const std::lock_guard<std::mutex> lock(m_deferred_mutex);
+            const auto it = m_deferred_replays.find(t_id);
+            if (it != m_deferred_replays.end() && it->second == t_replay)
+            {
+                m_deferred_replays.erase(it);
+            }
+            size = t_replay->size;
+        }
+        {
+            const std::lock_guard<std::mutex> lock(t_replay->mutex);
+            t_replay->started = true;
+        }
+        t_replay->cv.notify_all();
+
+        std::shared_ptr<const dc::Page> page;
+        const auto index = m_data_store->find_index(t_id);
+        // m_rdevice_alive is only modified on the R thread
+        const auto page_lock = (m_rdevice_alive && index) ? m_page_lock(*index) : nullptr;
+        if (page_lock)
+        {
+            const std::lock_guard<std::shared_mutex> lock(*page_lock);
+            if (m_data_store->diff(*index, size))
+            {
+                m_rdevice->api_prerender(*index, size.x, size.y);
+            }
+            page = m_data_store->snapshot(*index);
+        }
+
+        bool abandoned;
+        {
+            const std::lock_guard<std::mutex> lock(t_replay->mutex);
+            t_replay->page = page;
+            t_replay->done = true;
+            abandoned = t_replay->abandoned;
+        }
+        t_replay->cv.notify_all();
+
+        if (abandoned && page)
+        {
+            // clients got a provisional plot, let them fetch the exact one
+            m_data_store->inc_upid();
+            if (broadcast_notify_change)
+            {
+                broadcast_notify_change();
+            }
         }
-        return m_data_store->render(index, t_renderer, t_scale);
     }
 
     boost::optional<int> HttpgdApiAsync::api_index(int32_t id)
@@ -85,6 +338,16 @@ namespace httpgd
     {
         return m_data_store->state();
     }
+
+    boost::optional<HttpgdPageVersion> HttpgdApiAsync::api_version(int index, double width, double height)
+    {
+        return m_data_store->version(index, {width, height});
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdApiAsync::api_raster(int index, std::uint64_t hash, double scale, const dc::RenderOptions &options)
+    {
+        return m_data_store->raster(index, hash, scale, options);
+    }
     
     HttpgdQueryResults HttpgdApiAsync::api_query_all()
     {
@@ -106,8 +369,14 @@ namespace httpgd
 
     void HttpgdApiAsync::rdevice_destructing()
     {
-        const std::lock_guard<std::mutex> lock(m_rdevice_alive_mutex);
-        m_rdevice_alive = false;
+        {
+            const std::lock_guard<std::mutex> lock(m_rdevice_alive_mutex);
+            m_rdevice_alive = false;
+        }
+        // replays that are still queued do nothing anymore
+        const std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        m_deferred_stopped = true;
+        m_deferred_replays.clear();
     }
 
 } // namespace httpgd
\ No newline at end of file
@@ -2,9 +2,12 @@
 #define HTTPGD_HTTPGD_API_ASYNC_H
 
 #include <string>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <functional>
+#include <unordered_map>
 #include <vector>
 #include "HttpgdApi.h"
 #include "HttpgdCommons.h"
@@ -19,7 +22,7 @@ namespace httpgd
         virtual void plot_changed(int upid) = 0;
     };
 
-    class HttpgdApiAsync : public HttpgdApi
+    class HttpgdApiAsync : public HttpgdApi, public std::enable_shared_from_this<HttpgdApiAsync>
     {
 
     public:
@@ -36,10 +39,26 @@ namespace httpgd
 
         // Calls that MAYBE synchronize with R
         bool api_render(int index, double width, double height, dc::RenderingTarget *t_renderer, double t_scale) override;
+        std::shared_ptr<const std::string> api_render_string(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options) override;
+        std::shared_ptr<const std::vector<unsigned char>> api_render_binary(int index, double width, double height, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options) override;
         boost::optional<int> api_index(int32_t id) override;
+        // Passes the output to t_sink while it is rendered, see
+        // HttpgdDataStore::render_string().
+        std::shared_ptr<const std::string> api_render_string(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options,
+                                                             const dc::StringRenderingTarget::sink_t &t_sink, std::size_t t_chunk_size);
+
+        // Fast path for size changes (opt-in): If the page would have to be
+        // replayed in the requested size and R is busy, the stored page is
+        // scaled to it and rendered instead (t_provisional is set). The
+        // exact replay runs when R is idle, clients are notified through a
+        // state change then.
+        std::shared_ptr<const std::string> api_render_string_provisional(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options, bool &t_provisional);
+        std::shared_ptr<const std::vector<unsigned char>> api_render_binary_provisional(int index, double width, double height, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options, bool &t_provisional);
         
         // Calls that DONT synchronize with R
         HttpgdState api_state() override;
+        boost::optional<HttpgdPageVersion> api_version(int index, double width, double height) override;
+        std::shared_ptr<const std::vector<unsigned char>> api_raster(int index, std::uint64_t hash, double scale, const dc::RenderOptions &options) override;
         HttpgdQueryResults api_query_all() override;
         HttpgdQueryResults api_query_index(int index) override;
         HttpgdQueryResults api_query_range(int offset, int limit) override;
@@ -55,6 +74,41 @@ namespace httpgd
         
         std::shared_ptr<HttpgdServerConfig> m_svr_config;
         std::shared_ptr<HttpgdDataStore> m_data_store;
+
+        // Renders may run concurrently. A page that is replayed in a
+        // different size is locked exclusively while R draws it, renders
+        // of that page take their snapshot under a shared lock. Other
+        // pages are not affected.
+        std::mutex m_page_locks_mutex;
+        std::unordered_map<page_id_t, std::shared_ptr<std::shared_mutex>> m_page_locks;
+
+        // Replay of a page requested by provisional renders, runs as an R
+        // task. Requests wait for it if R starts it right away.
+        struct DeferredReplay
+        {
+            gvertex<double> size; // guarded by m_deferred_mutex, the latest requested size wins
+
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool started = false;
+            bool done = false;
+            bool abandoned = false; // a request did not wait for it
+            std::shared_ptr<const dc::Page> page;
+        };
+
+        // Deferred replays that have not been started by R yet
+        std::mutex m_deferred_mutex;
+        std::unordered_map<page_id_t, std::shared_ptr<DeferredReplay>> m_deferred_replays;
+        bool m_deferred_stopped = false;
+
+        std::shared_ptr<std::shared_mutex> m_page_lock(int index);
+        std::shared_ptr<const dc::Page> m_replay(int index, gvertex<double> t_size);
+        template <typename F>
+        auto m_render_sized(int index, double width, double height, F &&t_render);
+        template <typename F, typename G>
+        auto m_render_provisional(int index, double width, double height, bool &t_provisional, F &&t_render, G &&t_render_page);
+        std::shared_ptr<DeferredReplay> m_schedule_replay(page_id_t t_id, gvertex<double> t_size);
+        void m_run_deferred_replay(page_id_t t_id, const std::shared_ptr<DeferredReplay> &t_replay);
     };
 } // namespace httpgd
 
@@ -2,6 +2,7 @@
 #ifndef HTTPGD_COMMONS_H
 #define HTTPGD_COMMONS_H
 
+#include <cstdint>
 #include <limits>
 #include <string>
 #include <vector>
@@ -26,6 +27,15 @@ namespace httpgd
         bool active;
     };
 
+    // Identifies the content of a page at its current size.
+    struct HttpgdPageVersion {
+        int32_t id;
+        uint64_t version;
+        double width;
+        double height;
+        std::size_t draw_calls;
+    };
+
     struct HttpgdQueryResults {
         HttpgdState state;
         std::vector<int32_t> ids;
@@ -43,6 +53,10 @@ namespace httpgd
         bool webserver;
         bool silent;
         std::string id;
+        int threads;
+        int update_interval; // ms
+        int compression_level; // 0: off
+        int compression_min_size; // bytes
     };
 
 } // namespace httpgd
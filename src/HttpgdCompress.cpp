@@ -8,11 +8,13 @@ namespace httpgd
 {
     namespace compr
     {
-        template<typename charTypeIn, typename charTypeOut>
-        static std::vector<charTypeOut> compressToGzip(const charTypeIn *input, size_t inputSize)
+        // windowBits 15 | 16 writes a gzip wrapper, 15 a zlib wrapper
+        template<typename charTypeIn, typename bufferType>
+        static bufferType compressToGzip(const charTypeIn *input, size_t inputSize,
+                                         int level = Z_DEFAULT_COMPRESSION, int windowBits = 15 | 16)
         {
             static_assert(sizeof(charTypeIn) == 1, "input not a char type");
-            static_assert(sizeof(charTypeOut) == 1, "output not a char type vector");
+            static_assert(sizeof(typename bufferType::value_type) == 1, "output not a char type container");
 
             z_stream zs;
             zs.zalloc = Z_NULL;
@@ -21,12 +23,12 @@ namespace httpgd
             zs.avail_in = static_cast<uInt>(inputSize);
             zs.next_in = (Bytef *)input;
 
-            int ret = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY);
+            int ret = deflateInit2(&zs, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
             if (ret != Z_OK) {
-                return std::vector<charTypeOut> {};
+                return bufferType {};
             }
             
-            std::vector<charTypeOut> buffer;
+            bufferType buffer;
 
             for (;;) {
                 const int chunk_size = 16384;
@@ -38,7 +40,7 @@ namespace httpgd
                 ret = deflate(&zs, Z_FINISH);
                 if (ret == Z_STREAM_ERROR) {
                     deflateEnd(&zs);
-                    return std::vector<charTypeOut> {};
+                    return bufferType {};
                 } 
                 buffer.resize(old_size + (chunk_size - zs.avail_out));
                 
@@ -52,7 +54,92 @@ namespace httpgd
 
         std::vector<unsigned char> compress_str(const std::string &s)
         {
-            return compressToGzip<char, unsigned char>(s.c_str(), s.size());
+            return compressToGzip<char, std::vector<unsigned char>>(s.c_str(), s.size());
+        }
+
+        std::string compress_gzip(const std::string &s, int level)
+        {
+            return compressToGzip<char, std::string>(s.c_str(), s.size(), level, 15 | 16);
+        }
+
+        std::string compress_deflate(const std::string &s, int level)
+        {
+            return compressToGzip<char, std::string>(s.c_str(), s.size(), level, 15);
+        }
+
+        GzipStream::GzipStream(int t_level)
+            : m_zs(std::make_unique<z_stream>())
+        {
+            m_zs->zalloc = Z_NULL;
+            m_zs->zfree = Z_NULL;
+            m_zs->opaque = Z_NULL;
+            m_ok = deflateInit2(m_zs.get(), t_level, Z_DEFLATED, 15 | 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+
+        GzipStream::~GzipStream()
+        {
+            if (m_ok)
+            {
+                deflateEnd(m_zs.get());
+            }
+        }
+
+        void GzipStream::write(const char *t_data, std::size_t t_size)
+        {
+            if (!m_ok || t_size == 0)
+            {
+                return;
+            }
+            m_zs->avail_in = static_cast<uInt>(t_size);
+            m_zs->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(t_data));
+            m_deflate(Z_NO_FLUSH);
+        }
+
+        std::vector<unsigned char> GzipStream::take()
+        {
+            std::vector<unsigned char> out;
+            out.swap(m_out);
+            return out;
+        }
+
+        std::vector<unsigned char> GzipStream::finish()
+        {
+            if (!m_ok)
+            {
+                return {};
+            }
+            m_zs->avail_in = 0;
+            m_zs->next_in = Z_NULL;
+            m_deflate(Z_FINISH);
+            if (!m_ok)
+            {
+                return {};
+            }
+            deflateEnd(m_zs.get());
+            m_ok = false;
+            return std::move(m_out);
+        }
+
+        void GzipStream::m_deflate(int t_flush)
+        {
+            for (;;) {
+                const int chunk_size = 16384;
+                const size_t old_size = m_out.size();
+                m_out.resize(m_out.size() + chunk_size);
+
+                m_zs->avail_out = chunk_size;
+                m_zs->next_out = &m_out[old_size];
+                const int ret = deflate(m_zs.get(), t_flush);
+                m_out.resize(old_size + (chunk_size - m_zs->avail_out));
+                if (ret == Z_STREAM_ERROR) {
+                    deflateEnd(m_zs.get());
+                    m_ok = false;
+                    return;
+                }
+                if (m_zs->avail_out != 0) {
+                    break;
+                }
+            }
         }
 
     } // namespace compress
@@ -1,15 +1,46 @@
 #ifndef COMPRESSION_H
 #define COMPRESSION_H
 
+#include <memory>
 #include <string>
 #include <vector>
 
+struct z_stream_s;
+
 namespace httpgd
 {
     namespace compr
     {
         std::vector<unsigned char> compress_str(const std::string &s);
 
+        // HTTP content codings, empty result on failure
+        std::string compress_gzip(const std::string &s, int level);
+        std::string compress_deflate(const std::string &s, int level);
+
+        // Incremental gzip compression, input can be written in pieces
+        // and only the compressed output is kept in memory.
+        class GzipStream
+        {
+        public:
+            explicit GzipStream(int t_level = -1);
+            ~GzipStream();
+            GzipStream(const GzipStream &) = delete;
+            GzipStream &operator=(const GzipStream &) = delete;
+
+            void write(const char *t_data, std::size_t t_size);
+            // Takes the compressed output produced so far.
+            std::vector<unsigned char> take();
+            // Returns the remaining compressed output (empty on failure).
+            std::vector<unsigned char> finish();
+
+        private:
+            std::unique_ptr<z_stream_s> m_zs;
+            std::vector<unsigned char> m_out;
+            bool m_ok;
+
+            void m_deflate(int t_flush);
+        };
+
     } // namespace compress
 
 } // namespace httpgd
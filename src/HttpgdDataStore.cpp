@@ -1,5 +1,9 @@
 
 #include "HttpgdDataStore.h"
+#include "Base64.h"
+#include "RendererSvg.h"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
 
@@ -7,48 +11,60 @@
 
 namespace httpgd
 {
-    inline bool HttpgdDataStore::m_valid_index(page_index_t t_index)
+    // Renders of renderers that ignore the options are cached once for all
+    // of them.
+    template <typename T>
+    static inline dc::RenderOptions key_options(const RendererManagerInfo<T> &t_renderer, const dc::RenderOptions &t_options)
     {
-        auto psize = m_pages.size();
-        return (psize > 0 && (t_index >= -1 && t_index < static_cast<int>(psize)));
+        return t_renderer.uses_options ? t_options : dc::RenderOptions{};
     }
-    inline std::size_t HttpgdDataStore::m_index_to_pos(page_index_t t_index)
+
+    std::shared_ptr<const dc::Page> HttpgdDataStore::snapshot(page_index_t t_index)
+    {
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
+        if (!m_valid_index(t_index))
+        {
+            return nullptr;
+        }
+        return m_pages[m_index_to_pos(t_index)];
+    }
+    dc::Page &HttpgdDataStore::m_page_mut(std::size_t t_pos)
     {
-        return (t_index == -1 ? (m_pages.size() - 1) : t_index);
+        auto &page = m_pages[t_pos];
+        if (page.use_count() > 1) // snapshot in use by a reader
+        {
+            page = std::make_shared<dc::Page>(*page);
+        }
+        else
+        {
+            // use_count() is a relaxed load, synchronize with the release
+            // of the last snapshot before modifying the page
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        page->version = ++m_version_counter;
+        return *page;
     }
 
     page_index_t HttpgdDataStore::append(gvertex<double> t_size)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
-        m_pages.emplace_back(m_id_counter, t_size);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
+        m_pages.push_back(std::make_shared<dc::Page>(m_id_counter, t_size));
+        m_pages.back()->version = ++m_version_counter;
 
         m_id_counter = incwrap(m_id_counter);
 
         return m_pages.size() - 1;
     }
-    void HttpgdDataStore::add_dc(page_index_t t_index, std::shared_ptr<dc::DrawCall> t_dc, bool t_silent)
-    {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
-        if (!m_valid_index(t_index))
-        {
-            return;
-        }
-        auto index = m_index_to_pos(t_index);
-        m_pages[index].put(t_dc);
-        if (!t_silent)
-        {
-            m_inc_upid();
-        }
-    }
     void HttpgdDataStore::clear(page_index_t t_index, bool t_silent)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
         if (!m_valid_index(t_index))
         {
             return;
         }
         auto index = m_index_to_pos(t_index);
-        m_pages[index].clear();
+        auto &page = m_page_mut(index);
+        page.clear();
         if (!t_silent)
         {
             m_inc_upid();
@@ -56,7 +72,7 @@ namespace httpgd
     }
     bool HttpgdDataStore::remove(page_index_t t_index, bool t_silent)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
 
         if (!m_valid_index(t_index))
         {
@@ -64,7 +80,13 @@ namespace httpgd
         }
         auto index = m_index_to_pos(t_index);
 
+        m_drop_variants(m_pages[index]->id);
         m_pages.erase(m_pages.begin() + index);
+        if (index == m_pages.size() && !m_pages.empty())
+        {
+            // the previous page is the newest page again
+            m_drop_variants(m_pages.back()->id);
+        }
         if (!t_silent) // if it was the last page
         {
             m_inc_upid();
@@ -73,107 +95,369 @@ namespace httpgd
     }
     bool HttpgdDataStore::remove_all()
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
 
         if (m_pages.empty())
         {
             return false;
         }
-        for (auto p : m_pages)
-        {
-            p.clear();
-        }
         m_pages.clear();
+        m_variants.clear();
+        m_variants_bytes = 0;
+        m_cache.clear();
         m_inc_upid();
         return true;
     }
     void HttpgdDataStore::fill(page_index_t t_index, color_t t_fill)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
         if (!m_valid_index(t_index))
         {
             return;
         }
         auto index = m_index_to_pos(t_index);
-        m_pages[index].fill = t_fill;
+        auto &page = m_page_mut(index);
+        page.fill = t_fill;
     }
     void HttpgdDataStore::resize(page_index_t t_index, gvertex<double> t_size)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
         if (!m_valid_index(t_index))
         {
             return;
         }
         auto index = m_index_to_pos(t_index);
-        m_pages[index].size = t_size;
-        m_pages[index].clear();
+        if (index + 1 < m_pages.size())
+        {
+            // keep the draw calls of the old size, the page is replaced by an
+            // empty one instead of being cleared
+            auto &slot = m_pages[index];
+            auto page = std::make_shared<dc::Page>(slot->id, t_size);
+            page->fill = slot->fill;
+            page->dc_seq = slot->dc_seq + 1;
+            page->dc_seq_base = page->dc_seq;
+            page->version = ++m_version_counter;
+            m_put_variant(std::move(slot));
+            slot = std::move(page);
+            return;
+        }
+        auto &page = m_page_mut(index);
+        page.size = t_size;
+        page.clear();
     }
     httpgd::gvertex<double> HttpgdDataStore::size(page_index_t t_index)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
         if (!m_valid_index(t_index))
         {
             return {10, 10};
         }
         auto index = m_index_to_pos(t_index);
-        return m_pages[index].size;
+        return m_pages[index]->size;
     }
     void HttpgdDataStore::clip(page_index_t t_index, grect<double> t_rect)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
         if (!m_valid_index(t_index))
         {
             return;
         }
         auto index = m_index_to_pos(t_index);
-        m_pages[index].clip(t_rect);
+        auto &page = m_page_mut(index);
+        page.clip(t_rect);
+    }
+
+    static bool needs_replay(gvertex<double> t_old_size, gvertex<double> t_new_size)
+    {
+        if (t_new_size.x < 0.1)
+        {
+            t_new_size.x = t_old_size.x;
+        }
+        if (t_new_size.y < 0.1)
+        {
+            t_new_size.y = t_old_size.y;
+        }
+        return (std::fabs(t_new_size.x - t_old_size.x) > 0.1 ||
+                std::fabs(t_new_size.y - t_old_size.y) > 0.1);
     }
 
     bool HttpgdDataStore::diff(page_index_t t_index, gvertex<double> t_size)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
         if (!m_valid_index(t_index))
         {
             return false;
         }
         auto index = m_index_to_pos(t_index);
 
-        // get current state
-        gvertex<double> new_size = t_size;
-        gvertex<double> old_size = m_pages[index].size;
+        // Check if replay needed
+        return needs_replay(m_pages[index]->size, t_size);
+    }
 
-        if (new_size.x < 0.1)
+    boost::optional<HttpgdPageVersion> HttpgdDataStore::version(page_index_t t_index, gvertex<double> t_size)
+    {
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
+        if (!m_valid_index(t_index))
         {
-            new_size.x = old_size.x;
+            return boost::none;
         }
-        if (new_size.y < 0.1)
+        const auto &page = *m_pages[m_index_to_pos(t_index)];
+        if (needs_replay(page.size, t_size))
         {
-            new_size.y = old_size.y;
+            return boost::none;
         }
-
-        // Check if replay needed
-        return (std::fabs(new_size.x - old_size.x) > 0.1 ||
-                std::fabs(new_size.y - old_size.y) > 0.1);
+        return HttpgdPageVersion{page.id, page.version, page.size.x, page.size.y, page.dcs.size()};
     }
     
-    bool HttpgdDataStore::render(page_index_t t_index, dc::RenderingTarget *t_renderer, double t_scale) 
+    bool HttpgdDataStore::restore(page_index_t t_index, gvertex<double> t_size)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
         if (!m_valid_index(t_index))
         {
             return false;
         }
         auto index = m_index_to_pos(t_index);
-        t_renderer->render(m_pages[index], std::fabs(t_scale));
+        auto &slot = m_pages[index];
+        const gvertex<double> size{t_size.x < 0.1 ? slot->size.x : t_size.x, t_size.y < 0.1 ? slot->size.y : t_size.y};
+        if (!needs_replay(slot->size, size))
+        {
+            return false;
+        }
+        const auto it = std::find_if(m_variants.begin(), m_variants.end(), [&](const std::shared_ptr<dc::Page> &t_variant) {
+            return t_variant->id == slot->id && !needs_replay(t_variant->size, size);
+        });
+        if (it == m_variants.end())
+        {
+            return false;
+        }
+        auto page = *it;
+        m_erase_variant(it);
+        if (page.use_count() > 1) // snapshot in use by a reader
+        {
+            page = std::make_shared<dc::Page>(*page);
+        }
+        else
+        {
+            std::atomic_thread_fence(std::memory_order_acquire); // see m_page_mut()
+        }
+        // continue the draw call sequence numbers of the current page, so
+        // clients can tell that the page has changed
+        const std::uint64_t seq_offset = slot->dc_seq + 1 - page->dc_seq_base;
+        page->dc_seq_base += seq_offset;
+        page->dc_seq += seq_offset;
+        page->version = ++m_version_counter;
+        m_put_variant(std::move(slot));
+        slot = std::move(page);
+        return true;
+    }
+
+    void HttpgdDataStore::m_put_variant(std::shared_ptr<dc::Page> t_page)
+    {
+        for (auto it = m_variants.begin(); it != m_variants.end();)
+        {
+            const auto &variant = *it;
+            if (variant->id == t_page->id && !needs_replay(variant->size, t_page->size))
+            {
+                it = m_erase_variant(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        const std::size_t bytes = t_page->bytes();
+        if (bytes > m_variants_max_bytes)
+        {
+            return; // would evict all others
+        }
+        m_variants_bytes += bytes;
+        m_variants.push_front(std::move(t_page));
+        while (m_variants_bytes > m_variants_max_bytes)
+        {
+            m_erase_variant(std::prev(m_variants.end()));
+        }
+    }
+
+    void HttpgdDataStore::m_drop_variants(page_id_t t_id)
+    {
+        for (auto it = m_variants.begin(); it != m_variants.end();)
+        {
+            it = (*it)->id == t_id ? m_erase_variant(it) : std::next(it);
+        }
+    }
+
+    std::list<std::shared_ptr<dc::Page>>::iterator HttpgdDataStore::m_erase_variant(std::list<std::shared_ptr<dc::Page>>::iterator t_it)
+    {
+        // variants are not modified while they are kept, so this is the
+        // size they were added with
+        m_variants_bytes -= (*t_it)->bytes();
+        return m_variants.erase(t_it);
+    }
+
+    bool HttpgdDataStore::render(page_index_t t_index, dc::RenderingTarget *t_renderer, double t_scale) 
+    {
+        return render(snapshot(t_index), t_renderer, t_scale);
+    }
+
+    std::shared_ptr<const std::string> HttpgdDataStore::render_string(page_index_t t_index, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        return render_string(snapshot(t_index), t_renderer, t_scale, t_options);
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdDataStore::render_binary(page_index_t t_index, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        return render_binary(snapshot(t_index), t_renderer, t_scale, t_options);
+    }
+
+    bool HttpgdDataStore::render(const std::shared_ptr<const dc::Page> &t_page, dc::RenderingTarget *t_renderer, double t_scale)
+    {
+        if (!t_page)
+        {
+            return false;
+        }
+        t_renderer->render(*t_page, std::fabs(t_scale));
         return true;
     }
 
+    std::shared_ptr<const std::string> HttpgdDataStore::render_string(const std::shared_ptr<const dc::Page> &t_page, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        if (!t_page)
+        {
+            return nullptr;
+        }
+        const RenderCacheKey key{t_page->id, t_page->version, t_page->size, std::fabs(t_scale), t_renderer.id, key_options(t_renderer, t_options)};
+
+        auto cached = m_cache.find_string(key);
+        if (cached)
+        {
+            return cached;
+        }
+        auto renderer = t_renderer.renderer(key.options);
+        renderer->render(*t_page, key.scale);
+        auto rendered = std::make_shared<const std::string>(renderer->take_string());
+        m_cache.put(key, rendered);
+        return rendered;
+    }
+
+    std::shared_ptr<const std::string> HttpgdDataStore::render_string(const std::shared_ptr<const dc::Page> &t_page, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options,
+                                                                      const dc::StringRenderingTarget::sink_t &t_sink, std::size_t t_chunk_size)
+    {
+        if (!t_page)
+        {
+            return nullptr;
+        }
+        const RenderCacheKey key{t_page->id, t_page->version, t_page->size, std::fabs(t_scale), t_renderer.id, key_options(t_renderer, t_options)};
+
+        auto cached = m_cache.find_string(key);
+        if (cached)
+        {
+            t_sink(cached->data(), cached->size());
+            return cached;
+        }
+        std::string output;
+        auto renderer = t_renderer.renderer(key.options);
+        renderer->stream([&](const char *t_data, std::size_t t_size) {
+            output.append(t_data, t_size);
+            t_sink(t_data, t_size);
+        }, t_chunk_size);
+        renderer->render(*t_page, key.scale);
+        auto rest = renderer->take_string(); // all of it if the renderer does not stream
+        t_sink(rest.data(), rest.size());
+        if (output.empty())
+        {
+            output = std::move(rest);
+        }
+        else
+        {
+            output.append(rest);
+        }
+        auto rendered = std::make_shared<const std::string>(std::move(output));
+        m_cache.put(key, rendered);
+        return rendered;
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdDataStore::render_binary(const std::shared_ptr<const dc::Page> &t_page, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        if (!t_page)
+        {
+            return nullptr;
+        }
+        const RenderCacheKey key{t_page->id, t_page->version, t_page->size, std::fabs(t_scale), t_renderer.id, key_options(t_renderer, t_options)};
+
+        auto cached = m_cache.find_binary(key);
+        if (cached)
+        {
+            return cached;
+        }
+        auto renderer = t_renderer.renderer(key.options);
+        renderer->render(*t_page, key.scale);
+        auto rendered = std::make_shared<const std::vector<unsigned char>>(renderer->take_binary());
+        m_cache.put(key, rendered);
+        return rendered;
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdDataStore::raster(page_index_t t_index, std::uint64_t t_hash, double t_scale, const dc::RenderOptions &t_options)
+    {
+        const auto page = snapshot(t_index);
+        if (!page)
+        {
+            return nullptr;
+        }
+
+        class RasterFinder : public dc::Renderer
+        {
+        public:
+            std::uint64_t hash;
+            bool fast;
+            std::shared_ptr<const std::vector<unsigned char>> png;
+
+            void raster(const dc::Raster &t_raster) override
+            {
+                if (!png && t_raster.hash == hash)
+                {
+                    png = std::make_shared<const std::vector<unsigned char>>(raster_png(t_raster, fast));
+                }
+            }
+        } finder;
+        finder.hash = t_hash;
+        finder.fast = t_options.fast_png;
+        for (const auto &dc : page->dcs)
+        {
+            if (dc.type == dc::DrawCallType::RASTER)
+            {
+                page->render(dc, &finder);
+                if (finder.png)
+                {
+                    return finder.png;
+                }
+            }
+        }
+        auto layer = dc::raster_layer_png(*page, t_hash, t_scale, t_options);
+        if (layer.empty())
+        {
+            return nullptr;
+        }
+        return std::make_shared<const std::vector<unsigned char>>(std::move(layer));
+    }
+
+    std::shared_ptr<const dc::Page> HttpgdDataStore::scaled(page_index_t t_index, gvertex<double> t_size)
+    {
+        const auto page = snapshot(t_index);
+        if (!page)
+        {
+            return nullptr;
+        }
+        auto copy = std::make_shared<dc::Page>(*page);
+        copy->rescale({t_size.x < 0.1 ? page->size.x : t_size.x, t_size.y < 0.1 ? page->size.y : t_size.y});
+        return copy;
+    }
+
     boost::optional<int> HttpgdDataStore::find_index(page_id_t t_id)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
         for (std::size_t i = 0; i != m_pages.size(); i++)
         {
-            if (m_pages[i].id == t_id)
+            if (m_pages[i]->id == t_id)
             {
                 return static_cast<int>(i);
             }
@@ -187,27 +471,38 @@ namespace httpgd
     }
     HttpgdState HttpgdDataStore::state()
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
         return {
             m_upid,
             m_pages.size(),
             m_device_active};
     }
 
+    RenderCacheStats HttpgdDataStore::cache_stats() const
+    {
+        return m_cache.stats();
+    }
+
+    void HttpgdDataStore::inc_upid()
+    {
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
+        m_inc_upid();
+    }
+
     void HttpgdDataStore::set_device_active(bool t_active)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
         m_device_active = t_active;
     }
 
     HttpgdQueryResults HttpgdDataStore::query_all()
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
 
         std::vector<page_id_t> res(m_pages.size());
         for (std::size_t i = 0; i != m_pages.size(); i++)
         {
-            res[i] = m_pages[i].id;
+            res[i] = m_pages[i]->id;
         }
         return {{m_upid,
                  m_pages.size(),
@@ -216,7 +511,7 @@ namespace httpgd
     }
     HttpgdQueryResults HttpgdDataStore::query_index(page_id_t t_index)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
 
         if (!m_valid_index(t_index))
         {
@@ -229,11 +524,11 @@ namespace httpgd
         return {{m_upid,
                  m_pages.size(),
                  m_device_active},
-                {m_pages[index].id}};
+                {m_pages[index]->id}};
     }
     HttpgdQueryResults HttpgdDataStore::query_range(page_id_t t_offset, page_id_t t_limit)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::shared_lock<std::shared_mutex> lock(m_store_mutex);
 
         if (!m_valid_index(t_offset))
         {
@@ -252,7 +547,7 @@ namespace httpgd
         std::vector<page_id_t> res(end - index);
         for (std::size_t i = index; i != end; i++)
         {
-            res[i - index] = m_pages[i].id;
+            res[i - index] = m_pages[i]->id;
         }
         return {{m_upid,
                  m_pages.size(),
@@ -262,7 +557,7 @@ namespace httpgd
 
     void HttpgdDataStore::extra_css(boost::optional<std::string> t_extra_css)
     {
-        const std::lock_guard<std::mutex> lock(m_store_mutex);
+        const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
         m_extra_css = t_extra_css;
     }
 
@@ -5,10 +5,14 @@
 #include "HttpgdApi.h"
 #include "HttpgdCommons.h"
 #include "HttpgdGeom.h"
+#include "HttpgdRenderCache.h"
+#include "RendererManager.h"
 
 #include <atomic>
 #include <functional>
+#include <list>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 
@@ -23,22 +27,65 @@ namespace httpgd
         boost::optional<page_index_t> find_index(page_id_t t_id);
 
         bool diff(page_index_t t_index, gvertex<double> t_size);
+        boost::optional<HttpgdPageVersion> version(page_index_t t_index, gvertex<double> t_size);
         std::string svg(page_index_t t_index);
         bool render(page_index_t t_index, dc::RenderingTarget *t_renderer, double t_scale);
+        std::shared_ptr<const std::string> render_string(page_index_t t_index, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options);
+        std::shared_ptr<const std::vector<unsigned char>> render_binary(page_index_t t_index, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options);
+        // Current state of a page (nullptr if there is no such page). It is
+        // not modified anymore and can be rendered without any locks.
+        std::shared_ptr<const dc::Page> snapshot(page_index_t t_index);
+        bool render(const std::shared_ptr<const dc::Page> &t_page, dc::RenderingTarget *t_renderer, double t_scale);
+        std::shared_ptr<const std::string> render_string(const std::shared_ptr<const dc::Page> &t_page, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options);
+        std::shared_ptr<const std::vector<unsigned char>> render_binary(const std::shared_ptr<const dc::Page> &t_page, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options);
+        // Passes the output to t_sink while it is rendered, in pieces of
+        // about t_chunk_size bytes for renderers that support it (see
+        // dc::StringRenderingTarget::stream()). The complete output is
+        // cached and returned. Cached renders are passed in one piece.
+        std::shared_ptr<const std::string> render_string(const std::shared_ptr<const dc::Page> &t_page, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options,
+                                                         const dc::StringRenderingTarget::sink_t &t_sink, std::size_t t_chunk_size);
+        // PNG image of the raster draw call or dense layer with hash t_hash
+        // (see dc::raster_layer_png()), nullptr if the page has none.
+        std::shared_ptr<const std::vector<unsigned char>> raster(page_index_t t_index, std::uint64_t t_hash, double t_scale, const dc::RenderOptions &t_options);
+        // Copy of the page scaled to t_size (see dc::Page::rescale),
+        // nullptr if there is no such page.
+        std::shared_ptr<const dc::Page> scaled(page_index_t t_index, gvertex<double> t_size);
 
         page_index_t append(gvertex<double> t_size);
         void clear(page_index_t t_index, bool t_silent);
         bool remove(page_index_t t_index, bool t_silent);
         bool remove_all();
         void resize(page_index_t t_index, gvertex<double> t_size);
+        // Swaps in the draw calls of the page in size t_size if they are
+        // still kept from an earlier replay, false if it has to be
+        // replayed.
+        bool restore(page_index_t t_index, gvertex<double> t_size);
         gvertex<double> size(page_index_t t_index);
 
         void fill(page_index_t t_index, color_t t_fill);
-        void add_dc(page_index_t t_index, std::shared_ptr<dc::DrawCall> t_dc, bool t_silent);
+        // t_put is called with the page to append draw calls to
+        template <typename F>
+        void add_dc(page_index_t t_index, F &&t_put, bool t_silent)
+        {
+            const std::lock_guard<std::shared_mutex> lock(m_store_mutex);
+            if (!m_valid_index(t_index))
+            {
+                return;
+            }
+            auto &page = m_page_mut(m_index_to_pos(t_index));
+            t_put(page);
+            if (!t_silent)
+            {
+                m_inc_upid();
+            }
+        }
         void clip(page_index_t t_index, grect<double> t_rect);
 
         HttpgdState state();
         void set_device_active(bool t_active);
+        // Marks the plots as changed (new update id) when they were only
+        // replayed (silently) in another size.
+        void inc_upid();
 
         HttpgdQueryResults query_all();
         HttpgdQueryResults query_index(page_index_t t_index);
@@ -46,21 +93,48 @@ namespace httpgd
 
         void extra_css(boost::optional<std::string> t_extra_css);
 
+        RenderCacheStats cache_stats() const;
+
     private:
-        std::mutex m_store_mutex;
+        // Readers share the lock and only hold it to take a snapshot
+        // (reference) of a page. Writers copy a page before modifying
+        // it when a snapshot of it is still in use (copy-on-write).
+        std::shared_mutex m_store_mutex;
 
         page_id_t m_id_counter = 0;
-        std::vector<dc::Page> m_pages;
+        std::uint64_t m_version_counter = 0;
+        std::vector<std::shared_ptr<dc::Page>> m_pages;
         int m_upid = 0;
         bool m_device_active = true;
 
         boost::optional<std::string> m_extra_css;
 
-        void m_inc_upid();
+        RenderCache m_cache{32 * 1024 * 1024}; // 32 MiB
 
-        inline bool m_valid_index(page_index_t t_index);
-        inline size_t m_index_to_pos(page_index_t t_index);
-        
+        // Pages as they were before they were replayed in another size
+        // (most recently used first). Only kept for pages that are not the
+        // newest page, which R may still draw to. Bounded by the
+        // approximate memory of the kept pages.
+        std::list<std::shared_ptr<dc::Page>> m_variants;
+        std::size_t m_variants_bytes = 0;
+        std::size_t m_variants_max_bytes = 64 * 1024 * 1024; // 64 MiB
+
+        void m_inc_upid();
+        void m_put_variant(std::shared_ptr<dc::Page> t_page);
+        void m_drop_variants(page_id_t t_id);
+        std::list<std::shared_ptr<dc::Page>>::iterator m_erase_variant(std::list<std::shared_ptr<dc::Page>>::iterator t_it);
+
+        dc::Page &m_page_mut(std::size_t t_pos);
+
+        inline bool m_valid_index(page_index_t t_index)
+        {
+            auto psize = m_pages.size();
+            return (psize > 0 && (t_index >= -1 && t_index < static_cast<int>(psize)));
+        }
+        inline size_t m_index_to_pos(page_index_t t_index)
+        {
+            return (t_index == -1 ? (m_pages.size() - 1) : t_index);
+        }
     };
 
 } // namespace httpgd
@@ -253,7 +253,9 @@ namespace httpgd
 
     void HttpgdDev::dev_line(double x1, double y1, double x2, double y2, pGEcontext gc, pDevDesc dd)
     {
-        put(std::make_shared<dc::Line>(gc_lineinfo(gc), gvertex<double>{x1, y1}, gvertex<double>{x2, y2}));
+        put([&](dc::Page &page) {
+            page.put_line(gc_lineinfo(gc), {x1, y1}, {x2, y2});
+        });
     }
     void HttpgdDev::dev_text(double x, double y, const char *str, double rot, double hadj, pGEcontext gc, pDevDesc dd)
     {
@@ -274,76 +276,59 @@ namespace httpgd
             feature += (i == font_info.n_features - 1 ? ";" : ",");
         }
 
-        put(std::make_shared<dc::Text>(gc->col, gvertex<double>{x, y}, str, rot, hadj,
-                                       dc::TextInfo{
-                                           weight,
-                                           feature,
-                                           fontname(gc->fontfamily, gc->fontface, system_aliases, user_aliases, font_info),
-                                           gc->cex * gc->ps,
-                                           is_italic(gc->fontface),
-                                           m_fix_strwidth ? dev_strWidth(str, gc, dd) : -1.0}));
+        dc::TextInfo text{
+            weight,
+            feature,
+            fontname(gc->fontfamily, gc->fontface, system_aliases, user_aliases, font_info),
+            gc->cex * gc->ps,
+            is_italic(gc->fontface)};
+        const double txtwidth_px = m_fix_strwidth ? dev_strWidth(str, gc, dd) : -1.0;
+        put([&](dc::Page &page) {
+            page.put_text(gc->col, {x, y}, str, rot, hadj, std::move(text), txtwidth_px);
+        });
     }
     void HttpgdDev::dev_rect(double x0, double y0, double x1, double y1, pGEcontext gc, pDevDesc dd)
     {
-        put(std::make_shared<dc::Rect>(gc_lineinfo(gc), gc_fill(gc), normalize_rect(x0, y0, x1, y1)));
+        put([&](dc::Page &page) {
+            page.put_rect(gc_lineinfo(gc), gc_fill(gc), normalize_rect(x0, y0, x1, y1));
+        });
     }
     void HttpgdDev::dev_circle(double x, double y, double r, pGEcontext gc, pDevDesc dd)
     {
-        put(std::make_shared<dc::Circle>(gc_lineinfo(gc), gc_fill(gc), gvertex<double>{x, y}, r));
+        put([&](dc::Page &page) {
+            page.put_circle(gc_lineinfo(gc), gc_fill(gc), {x, y}, r);
+        });
     }
     void HttpgdDev::dev_polygon(int n, double *x, double *y, pGEcontext gc, pDevDesc dd)
     {
-        std::vector<gvertex<double>> points(n);
-        for (int i = 0; i < n; ++i)
-        {
-            points[i] = {x[i], y[i]};
-        }
-        put(std::make_shared<dc::Polygon>(gc_lineinfo(gc), gc_fill(gc), std::move(points)));
+        put([&](dc::Page &page) {
+            page.put_polygon(gc_lineinfo(gc), gc_fill(gc), n, x, y);
+        });
     }
     void HttpgdDev::dev_polyline(int n, double *x, double *y, pGEcontext gc, pDevDesc dd)
     {
-        std::vector<gvertex<double>> points(n);
-        for (int i = 0; i < n; ++i)
-        {
-            points[i] = {x[i], y[i]};
-        }
-        put(std::make_shared<dc::Polyline>(gc_lineinfo(gc), std::move(points)));
+        put([&](dc::Page &page) {
+            page.put_polyline(gc_lineinfo(gc), n, x, y);
+        });
     }
     void HttpgdDev::dev_path(double *x, double *y, int npoly, int *nper, Rboolean winding, pGEcontext gc, pDevDesc dd)
     {
-        std::vector<int> vnper(nper, nper + npoly);
-        int npoints = 0;
-        for (const auto &val : vnper)
-        {
-            npoints += val;
-        }
-        std::vector<gvertex<double>> points(npoints);
-        for (int i = 0; i < npoints; ++i)
-        {
-            points[i] = {x[i], y[i]};
-        }
-
-        put(std::make_shared<dc::Path>(gc_lineinfo(gc), gc_fill(gc), std::move(points), std::move(vnper), winding));
+        put([&](dc::Page &page) {
+            page.put_path(gc_lineinfo(gc), gc_fill(gc), npoly, nper, x, y, winding);
+        });
     }
     void HttpgdDev::dev_raster(unsigned int *raster, int w, int h, double x, double y, double width, double height, double rot, Rboolean interpolate, pGEcontext gc, pDevDesc dd)
     {
         const double abs_height = std::fabs(height);
         const double abs_width = std::fabs(width);
 
-        std::vector<unsigned int> vraster(raster, raster + (w * h));
-        put(std::make_shared<dc::Raster>(std::move(vraster), gvertex<int>{w, h}, grect<double>{x, y - abs_height, abs_width, abs_height}, rot, interpolate));
+        put([&](dc::Page &page) {
+            page.put_raster(raster, {w, h}, {x, y - abs_height, abs_width, abs_height}, rot, interpolate);
+        });
     }
 
     // OTHER
 
-    void HttpgdDev::put(std::shared_ptr<dc::DrawCall> dc)
-    {
-        if (m_target.is_void())
-            return;
-
-        m_data_store->add_dc(m_target.get_index(), dc, replaying);
-    }
-
     void HttpgdDev::api_prerender(int index, double width, double height)
     {
         if (index == -1)
@@ -353,6 +338,12 @@ namespace httpgd
 
         debug_print("[render_page] index=%i\n", index);
 
+        if (m_data_store->restore(index, {width, height}))
+        {
+            debug_print("    -> restored kept size\n");
+            return;
+        }
+
         replaying = true;
         m_data_store->resize(index, {width, height}); // this also clears
         if (index == m_target.get_newest_index())
@@ -443,11 +434,39 @@ namespace httpgd
         return m_data_store->render(index, t_renderer, t_scale);
     }
 
+    std::shared_ptr<const std::string> HttpgdDev::api_render_string(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        if (m_data_store->diff(index, {width, height}))
+        {
+            api_prerender(index, width, height);
+        }
+        return m_data_store->render_string(index, t_renderer, t_scale, t_options);
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdDev::api_render_binary(int index, double width, double height, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options)
+    {
+        if (m_data_store->diff(index, {width, height}))
+        {
+            api_prerender(index, width, height);
+        }
+        return m_data_store->render_binary(index, t_renderer, t_scale, t_options);
+    }
+
     boost::optional<int> HttpgdDev::api_index(int32_t id)
     {
         return m_data_store->find_index(id);
     }
 
+    boost::optional<HttpgdPageVersion> HttpgdDev::api_version(int index, double width, double height)
+    {
+        return m_data_store->version(index, {width, height});
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> HttpgdDev::api_raster(int index, std::uint64_t hash, double scale, const dc::RenderOptions &options)
+    {
+        return m_data_store->raster(index, hash, scale, options);
+    }
+
     bool HttpgdDev::server_start()
     {
         if (m_server && !m_server_running)
@@ -468,6 +487,10 @@ namespace httpgd
     {
         return m_server ? m_server->port() : 0;
     }
+    RenderCacheStats HttpgdDev::cache_stats() const
+    {
+        return m_data_store->cache_stats();
+    }
 
     std::shared_ptr<HttpgdServerConfig> HttpgdDev::api_server_config()
     {
@@ -64,6 +64,7 @@ namespace httpgd
         bool server_start();
         void server_stop();
         unsigned short server_port() const;
+        RenderCacheStats cache_stats() const;
 
         // API functions
 
@@ -75,7 +76,11 @@ namespace httpgd
         HttpgdQueryResults api_query_index(int index) override;
         HttpgdQueryResults api_query_range(int offset, int limit) override;
         bool api_render(int index, double width, double height, dc::RenderingTarget *t_renderer, double t_scale) override;
+        std::shared_ptr<const std::string> api_render_string(int index, double width, double height, const StringRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options) override;
+        std::shared_ptr<const std::vector<unsigned char>> api_render_binary(int index, double width, double height, const BinaryRendererInfo &t_renderer, double t_scale, const dc::RenderOptions &t_options) override;
         virtual boost::optional<int> api_index(int32_t id) override;
+        boost::optional<HttpgdPageVersion> api_version(int index, double width, double height) override;
+        std::shared_ptr<const std::vector<unsigned char>> api_raster(int index, std::uint64_t hash, double scale, const dc::RenderOptions &options) override;
         virtual std::shared_ptr<HttpgdServerConfig> api_server_config() override;
 
 
@@ -114,7 +119,15 @@ namespace httpgd
         bool m_initialized{false};
         bool m_server_running{false};
 
-        void put(std::shared_ptr<dc::DrawCall> dc);
+        // append draw call(s) to the target page, t_put is called with the page
+        template <typename F>
+        void put(F &&t_put)
+        {
+            if (m_target.is_void())
+                return;
+
+            m_data_store->add_dc(m_target.get_index(), std::forward<F>(t_put), replaying);
+        }
 
         // set device size
         void resize_device_to_page(pDevDesc dd);
@@ -0,0 +1,140 @@
+#include "HttpgdRenderCache.h"
+
+#include <functional>
+
+namespace httpgd
+{
+    bool RenderCacheKey::operator==(const RenderCacheKey &t_other) const
+    {
+        return page_id == t_other.page_id &&
+               version == t_other.version &&
+               size.x == t_other.size.x &&
+               size.y == t_other.size.y &&
+               scale == t_other.scale &&
+               renderer_id == t_other.renderer_id &&
+               options == t_other.options;
+    }
+
+    std::size_t RenderCacheKeyHash::operator()(const RenderCacheKey &t_key) const
+    {
+        std::size_t h = std::hash<dc::page_id_t>{}(t_key.page_id);
+        const auto combine = [&h](std::size_t v) {
+            h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+        };
+        combine(std::hash<std::uint64_t>{}(t_key.version));
+        combine(std::hash<double>{}(t_key.size.x));
+        combine(std::hash<double>{}(t_key.size.y));
+        combine(std::hash<double>{}(t_key.scale));
+        combine(std::hash<std::string>{}(t_key.renderer_id));
+        combine(std::hash<int>{}(t_key.options.precision));
+        combine(std::hash<bool>{}(t_key.options.integer_coords));
+        combine(std::hash<double>{}(t_key.options.simplify));
+        combine(std::hash<bool>{}(t_key.options.cull));
+        combine(std::hash<std::size_t>{}(t_key.options.raster_threshold));
+        combine(std::hash<bool>{}(t_key.options.fast_png));
+        combine(std::hash<std::string>{}(t_key.options.raster_url));
+        if (t_key.options.viewport)
+        {
+            combine(std::hash<double>{}(t_key.options.viewport->x));
+            combine(std::hash<double>{}(t_key.options.viewport->y));
+            combine(std::hash<double>{}(t_key.options.viewport->width));
+            combine(std::hash<double>{}(t_key.options.viewport->height));
+        }
+        return h;
+    }
+
+    RenderCache::RenderCache(std::size_t t_capacity)
+        : m_capacity(t_capacity)
+    {
+    }
+
+    std::shared_ptr<const std::string> RenderCache::find_string(const RenderCacheKey &t_key)
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const auto *entry = m_find(t_key);
+        return entry ? entry->str : nullptr;
+    }
+
+    std::shared_ptr<const std::vector<unsigned char>> RenderCache::find_binary(const RenderCacheKey &t_key)
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const auto *entry = m_find(t_key);
+        return entry ? entry->bin : nullptr;
+    }
+
+    void RenderCache::put(const RenderCacheKey &t_key, std::shared_ptr<const std::string> t_value)
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t bytes = t_value->size();
+        m_put({t_key, std::move(t_value), nullptr, bytes});
+    }
+
+    void RenderCache::put(const RenderCacheKey &t_key, std::shared_ptr<const std::vector<unsigned char>> t_value)
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const std::size_t bytes = t_value->size();
+        m_put({t_key, nullptr, std::move(t_value), bytes});
+    }
+
+    void RenderCache::clear()
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        m_lookup.clear();
+        m_entries.clear();
+        m_size = 0;
+    }
+
+    std::size_t RenderCache::size() const
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return m_size;
+    }
+
+    RenderCacheStats RenderCache::stats() const
+    {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        return {m_entries.size(), m_size, m_capacity, m_hits, m_misses};
+    }
+
+    const RenderCache::Entry *RenderCache::m_find(const RenderCacheKey &t_key)
+    {
+        auto it = m_lookup.find(t_key);
+        if (it == m_lookup.end())
+        {
+            ++m_misses;
+            return nullptr;
+        }
+        ++m_hits;
+        // mark as most recently used
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return &(*it->second);
+    }
+
+    void RenderCache::m_put(Entry &&t_entry)
+    {
+        auto existing = m_lookup.find(t_entry.key);
+        if (existing != m_lookup.end())
+        {
+            m_erase(existing->second);
+        }
+        if (t_entry.bytes > m_capacity)
+        {
+            return; // would evict everything else
+        }
+        while (!m_entries.empty() && m_size + t_entry.bytes > m_capacity)
+        {
+            m_erase(std::prev(m_entries.end()));
+        }
+        m_size += t_entry.bytes;
+        m_entries.push_front(std::move(t_entry));
+        m_lookup[m_entries.front().key] = m_entries.begin();
+    }
+
+    void RenderCache::m_erase(EntryList::iterator t_it)
+    {
+        m_size -= t_it->bytes;
+        m_lookup.erase(t_it->key);
+        m_entries.erase(t_it);
+    }
+
+} // namespace httpgd
@@ -0,0 +1,95 @@
+#ifndef HTTPGD_RENDER_CACHE_H
+#define HTTPGD_RENDER_CACHE_H
+
+#include "DrawData.h"
+#include "HttpgdGeom.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Do not include any R headers here!
+
+namespace httpgd
+{
+    struct RenderCacheKey
+    {
+        dc::page_id_t page_id;
+        // pages get a new version on every change, so entries of older
+        // versions are never found again
+        std::uint64_t version;
+        gvertex<double> size;
+        double scale;
+        std::string renderer_id;
+        dc::RenderOptions options;
+
+        bool operator==(const RenderCacheKey &t_other) const;
+    };
+
+    struct RenderCacheKeyHash
+    {
+        std::size_t operator()(const RenderCacheKey &t_key) const;
+    };
+
+    struct RenderCacheStats
+    {
+        std::size_t entries;
+        std::size_t bytes;
+        std::size_t capacity;
+        std::size_t hits;
+        std::size_t misses;
+    };
+
+    /**
+     * Bounded least-recently-used cache of rendered plots.
+     * Entries are evicted when the summed size of the cached
+     * outputs exceeds the capacity (in bytes). Entries of outdated
+     * page versions are not removed explicitly, they age out.
+     */
+    class RenderCache
+    {
+    public:
+        explicit RenderCache(std::size_t t_capacity);
+
+        std::shared_ptr<const std::string> find_string(const RenderCacheKey &t_key);
+        std::shared_ptr<const std::vector<unsigned char>> find_binary(const RenderCacheKey &t_key);
+
+        void put(const RenderCacheKey &t_key, std::shared_ptr<const std::string> t_value);
+        void put(const RenderCacheKey &t_key, std::shared_ptr<const std::vector<unsigned char>> t_value);
+
+        void clear();
+
+        [[nodiscard]] std::size_t size() const;
+        [[nodiscard]] RenderCacheStats stats() const;
+
+    private:
+        mutable std::mutex m_mutex;
+
+        struct Entry
+        {
+            RenderCacheKey key;
+            std::shared_ptr<const std::string> str;
+            std::shared_ptr<const std::vector<unsigned char>> bin;
+            std::size_t bytes;
+        };
+        using EntryList = std::list<Entry>;
+
+        std::size_t m_capacity;
+        std::size_t m_size{0};
+        std::size_t m_hits{0};
+        std::size_t m_misses{0};
+        EntryList m_entries; // most recently used first
+        std::unordered_map<RenderCacheKey, EntryList::iterator, RenderCacheKeyHash> m_lookup;
+
+        // callers need to hold m_mutex
+        const Entry *m_find(const RenderCacheKey &t_key);
+        void m_put(Entry &&t_entry);
+        void m_erase(EntryList::iterator t_it);
+    };
+
+} // namespace httpgd
+
+#endif // HTTPGD_RENDER_CACHE_H
@@ -1,13 +1,18 @@
 //#include <Rcpp.h>
 #include "HttpgdWebServer.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
 #include <fstream>
 #include <thread>
 #include <sstream>
 #include <fmt/ostream.h>
 #include <boost/optional.hpp>
 
+#include "HttpgdCompress.h"
 #include "HttpgdVersion.h"
-#include "RendererSvg.h"
+#include "RendererJson.h"
 
 namespace httpgd
 {
@@ -86,6 +91,83 @@ namespace httpgd
             }
         }
 
+        static inline std::string url_encode(const std::string &t_str)
+        {
+            std::string res;
+            for (const char c : t_str)
+            {
+                if (std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' || c == '.' || c == '~')
+                {
+                    res += c;
+                }
+                else
+                {
+                    res += fmt::format("%{:02X}", static_cast<unsigned char>(c));
+                }
+            }
+            return res;
+        }
+
+        // Reads the "precision" (0-4), "integer", "simplify" (pixels),
+        // "cull", "raster" (draw calls), "viewport" ("x,y,w,h" in plot
+        // coordinates), "fastpng" and "rasterlinks" params, none if invalid.
+        static inline boost::optional<dc::RenderOptions> param_render_options(OB::Belle::Request::Params params, const HttpgdServerConfig &t_conf)
+        {
+            dc::RenderOptions options;
+            if (params.find("precision") != params.end())
+            {
+                const auto precision = param_int(params, "precision");
+                if (!precision || *precision < 0 || *precision > 4)
+                {
+                    return boost::none;
+                }
+                options.precision = *precision;
+            }
+            const auto integer = param_str(params, "integer");
+            options.integer_coords = integer && (*integer == "1" || *integer == "true");
+            if (params.find("simplify") != params.end())
+            {
+                const auto simplify = param_double(params, "simplify");
+                if (!simplify || !(*simplify >= 0 && *simplify <= 100))
+                {
+                    return boost::none;
+                }
+                options.simplify = *simplify;
+            }
+            const auto cull = param_str(params, "cull");
+            options.cull = cull && (*cull == "1" || *cull == "true");
+            if (params.find("raster") != params.end())
+            {
+                const auto raster = param_int(params, "raster");
+                if (!raster || *raster < 0)
+                {
+                    return boost::none;
+                }
+                options.raster_threshold = static_cast<std::size_t>(*raster);
+            }
+            const auto viewport = param_str(params, "viewport");
+            if (viewport)
+            {
+                double x, y, w, h;
+                if (std::sscanf(viewport->c_str(), "%lf,%lf,%lf,%lf", &x, &y, &w, &h) != 4 ||
+                    !(w > 0 && h > 0) || !std::isfinite(x + y + w + h))
+                {
+                    return boost::none;
+                }
+                options.viewport = grect<double>{x, y, w, h};
+            }
+            const auto fast_png = param_str(params, "fastpng");
+            options.fast_png = fast_png && (*fast_png == "1" || *fast_png == "true");
+            const auto raster_links = param_str(params, "rasterlinks");
+            if (raster_links && (*raster_links == "1" || *raster_links == "true"))
+            {
+                // Relative to /svg and /plot. Browsers do not send the token
+                // header when they load images, so it is part of the URL.
+                options.raster_url = t_conf.use_token ? "raster?token=" + url_encode(t_conf.token) + "&" : "raster?";
+            }
+            return options;
+        }
+
         static inline void json_write_state(std::ostream &buf, const HttpgdState &state)
         {
             fmt::print(buf, "{{ \"upid\": {}, \"hsize\": {}, \"active\": {} }}", state.upid, state.hsize, state.active);
@@ -115,6 +197,394 @@ namespace httpgd
             return buf.str();
         }
 
+        // Weak, as it is derived from the request and not from the rendered
+        // bytes: renderers may write different (but equivalent) documents
+        // for the same plot, e.g. svgp with random clip path ids.
+        static inline std::string plot_etag(const HttpgdServerConfig &t_conf, const HttpgdPageVersion &t_version, double t_zoom, const std::string &t_renderer_id,
+                                            const dc::RenderOptions &t_options)
+        {
+            return fmt::format(R""(W/"{}-{}-{}-{:.2f}x{:.2f}-{}-{}-{}{}-{}{}-{}{}{}{}")"", t_conf.id, t_version.id, t_version.version,
+                               t_version.width, t_version.height, t_zoom, t_renderer_id,
+                               t_options.precision, t_options.integer_coords ? "i" : "", t_options.simplify,
+                               t_options.cull ? "c" : "", t_options.raster_threshold, t_options.fast_png ? "f" : "",
+                               t_options.raster_url.empty() ? "" : "l",
+                               t_options.viewport ? fmt::format("-{},{},{},{}", t_options.viewport->x, t_options.viewport->y,
+                                                                t_options.viewport->width, t_options.viewport->height)
+                                                  : "");
+        }
+
+        // Marks a plot that was rendered from the stored page scaled to the
+        // requested size while the exact replay is pending.
+        template <typename T>
+        static inline void set_provisional(T &ctx)
+        {
+            ctx.res.set("X-HTTPGD-PROVISIONAL", "true");
+            ctx.res.set(OB::Belle::Header::cache_control, "no-store");
+        }
+
+        static inline std::string body_etag(const std::string &t_body)
+        {
+            return fmt::format(R""("{:016x}")"", std::hash<std::string>{}(t_body));
+        }
+
+        // Sets the ETag header. Returns true (and answers with 304) if the
+        // client already has this version (weak comparison).
+        template <typename T>
+        static inline bool not_modified(T &ctx, const std::string &t_etag)
+        {
+            ctx.res.set(OB::Belle::Header::etag, t_etag);
+            ctx.res.set(OB::Belle::Header::cache_control, "no-cache");
+            const auto inm = ctx.req[OB::Belle::Header::if_none_match];
+            const std::string if_none_match(inm.data(), inm.size());
+            const auto opaque = t_etag.substr(t_etag.find('"'));
+            if (if_none_match.empty() ||
+                (if_none_match != "*" && if_none_match.find(opaque) == std::string::npos))
+            {
+                return false;
+            }
+            ctx.res.result(OB::Belle::Status::not_modified);
+            return true;
+        }
+
+        // Picks a content coding from the Accept-Encoding header, returns an
+        // empty string if the response should not be encoded.
+        static std::string negotiate_encoding(const std::string &t_accept)
+        {
+            double q_gzip = -1, q_deflate = -1, q_any = -1;
+            std::size_t pos = 0;
+            while (pos < t_accept.size())
+            {
+                auto end = t_accept.find(',', pos);
+                if (end == std::string::npos)
+                {
+                    end = t_accept.size();
+                }
+                const auto item = t_accept.substr(pos, end - pos);
+                pos = end + 1;
+
+                const auto semi = item.find(';');
+                const auto name_begin = item.find_first_not_of(' ');
+                if (name_begin == std::string::npos || name_begin >= semi)
+                {
+                    continue;
+                }
+                const auto name_end = item.find_last_not_of(' ', semi == std::string::npos ? std::string::npos : semi - 1);
+                const auto name = item.substr(name_begin, name_end - name_begin + 1);
+                double q = 1;
+                const auto q_pos = item.find("q=", semi == std::string::npos ? item.size() : semi);
+                if (q_pos != std::string::npos)
+                {
+                    try
+                    {
+                        q = std::stod(item.substr(q_pos + 2));
+                    }
+                    catch (const std::exception &e)
+                    {
+                        q = 0;
+                    }
+                }
+                if (name == "gzip" || name == "x-gzip")
+                {
+                    q_gzip = q;
+                }
+                else if (name == "deflate")
+                {
+                    q_deflate = q;
+                }
+                else if (name == "*")
+                {
+                    q_any = q;
+                }
+            }
+            if (q_gzip < 0)
+            {
+                q_gzip = q_any;
+            }
+            if (q_deflate < 0)
+            {
+                q_deflate = q_any;
+            }
+            if (q_gzip > 0 && q_gzip >= q_deflate)
+            {
+                return "gzip";
+            }
+            if (q_deflate > 0)
+            {
+                return "deflate";
+            }
+            return "";
+        }
+
+        // The encoded bytes differ, only weak validators stay valid.
+        template <typename T>
+        static inline void weaken_etag(T &ctx)
+        {
+            const auto etag = ctx.res[OB::Belle::Header::etag];
+            if (!etag.empty() && etag.find("W/") != 0)
+            {
+                ctx.res.set(OB::Belle::Header::etag, "W/" + std::string(etag.data(), etag.size()));
+            }
+        }
+
+        // Compresses the response body if the client accepts it, returns
+        // boost::none if it should be sent as is.
+        template <typename T>
+        static inline boost::optional<std::string> encode_body(T &ctx, const HttpgdServerConfig &t_conf, const std::string &t_body)
+        {
+            const int level = std::min(9, t_conf.compression_level);
+            if (level <= 0)
+            {
+                return boost::none;
+            }
+            ctx.res.set(OB::Belle::Header::vary, "Accept-Encoding");
+            if (t_body.size() < static_cast<std::size_t>(std::max(0, t_conf.compression_min_size)))
+            {
+                return boost::none;
+            }
+            const auto accept = ctx.req[OB::Belle::Header::accept_encoding];
+            const auto encoding = negotiate_encoding(std::string(accept.data(), accept.size()));
+            if (encoding.empty())
+            {
+                return boost::none;
+            }
+            auto encoded = encoding == "gzip" ? compr::compress_gzip(t_body, level) : compr::compress_deflate(t_body, level);
+            if (encoded.empty())
+            {
+                return boost::none;
+            }
+            ctx.res.set(OB::Belle::Header::content_encoding, encoding);
+            weaken_etag(ctx);
+            return encoded;
+        }
+
+        // Sets the response body, compressed if the client accepts it.
+        template <typename T>
+        static inline void set_body(T &ctx, const HttpgdServerConfig &t_conf, const std::string &t_body)
+        {
+            auto encoded = encode_body(ctx, t_conf, t_body);
+            if (encoded)
+            {
+                ctx.res.body() = std::move(*encoded);
+            }
+            else
+            {
+                ctx.res.body() = t_body;
+            }
+        }
+
+        // Pages with at least this many draw calls are sent to the client
+        // while they are rendered, the render is cached at the same time.
+        constexpr std::size_t stream_min_draw_calls = 10000;
+        constexpr std::size_t stream_chunk_size = 64 * 1024;
+        // Other renders of at least this size are gzip encoded while they
+        // are sent in chunks, instead of compressing them in one go first.
+        constexpr std::size_t stream_min_size = 1024 * 1024;
+
+        // Body of a response that is produced on another thread: the
+        // producer pushes output, the session takes all of it that has
+        // not been sent yet once the previous chunk has been written.
+        class ChunkQueue
+        {
+        public:
+            using callback_t = std::function<void(std::string, OB::Belle::Status)>;
+
+            void push(const char *t_data, std::size_t t_size)
+            {
+                if (t_size == 0)
+                {
+                    return;
+                }
+                callback_t waiting;
+                std::string chunk;
+                {
+                    const std::lock_guard<std::mutex> lock(m_mutex);
+                    m_pending.append(t_data, t_size);
+                    if (!m_waiting)
+                    {
+                        return;
+                    }
+                    waiting = std::move(m_waiting);
+                    m_waiting = nullptr;
+                    chunk = std::move(m_pending);
+                    m_pending.clear();
+                }
+                waiting(std::move(chunk), OB::Belle::Status::ok);
+            }
+
+            // Ends the body (Status::ok) or the response (any other status).
+            void finish(OB::Belle::Status t_status)
+            {
+                callback_t waiting;
+                {
+                    const std::lock_guard<std::mutex> lock(m_mutex);
+                    m_finished = true;
+                    m_status = t_status;
+                    if (!m_waiting)
+                    {
+                        return;
+                    }
+                    waiting = std::move(m_waiting);
+                    m_waiting = nullptr;
+                }
+                waiting(std::string(), t_status); // nothing is pending while a callback waits
+            }
+
+            // see OB::Belle::Server::Http_Ctx::body_chunks
+            void next(callback_t t_callback)
+            {
+                std::string chunk;
+                auto status = OB::Belle::Status::ok;
+                {
+                    const std::lock_guard<std::mutex> lock(m_mutex);
+                    if (m_finished && m_status != OB::Belle::Status::ok)
+                    {
+                        status = m_status;
+                    }
+                    else if (!m_pending.empty())
+                    {
+                        chunk = std::move(m_pending);
+                        m_pending.clear();
+                    }
+                    else if (!m_finished)
+                    {
+                        m_waiting = std::move(t_callback);
+                        return;
+                    }
+                }
+                t_callback(std::move(chunk), status);
+            }
+
+        private:
+            std::mutex m_mutex;
+            std::string m_pending;
+            callback_t m_waiting;
+            bool m_finished = false;
+            OB::Belle::Status m_status = OB::Belle::Status::ok;
+        };
+
+        // Sends the output of t_render with chunked transfer encoding while
+        // it is rendered, gzip encoded if the client accepts it. t_render is
+        // called with the sink to render into and returns false if there is
+        // no such plot. It runs as a task of t_io, so the session strand
+        // writes the chunks in the meantime.
+        template <typename T, typename F>
+        static inline void render_streamed(T &ctx, net::io_context &t_io, const HttpgdServerConfig &t_conf, F &&t_render)
+        {
+            std::shared_ptr<compr::GzipStream> gzip;
+            if (t_conf.compression_level > 0)
+            {
+                ctx.res.set(OB::Belle::Header::vary, "Accept-Encoding");
+                const auto accept = ctx.req[OB::Belle::Header::accept_encoding];
+                if (negotiate_encoding(std::string(accept.data(), accept.size())) == "gzip")
+                {
+                    gzip = std::make_shared<compr::GzipStream>(std::min(9, t_conf.compression_level));
+                    ctx.res.set(OB::Belle::Header::content_encoding, "gzip");
+                    weaken_etag(ctx);
+                }
+            }
+
+            auto queue = std::make_shared<ChunkQueue>();
+            ctx.body_chunks = [queue](ChunkQueue::callback_t t_next) {
+                queue->next(std::move(t_next));
+            };
+            net::post(t_io, [queue, gzip, render = std::forward<F>(t_render)]() mutable {
+                const auto sink = [&](const char *t_data, std::size_t t_size) {
+                    if (!gzip)
+                    {
+                        queue->push(t_data, t_size);
+                        return;
+                    }
+                    gzip->write(t_data, t_size);
+                    const auto out = gzip->take();
+                    queue->push(reinterpret_cast<const char *>(out.data()), out.size());
+                };
+                try
+                {
+                    if (!render(sink))
+                    {
+                        queue->finish(OB::Belle::Status::not_found); // nothing has been sent yet
+                        return;
+                    }
+                    if (gzip)
+                    {
+                        const auto out = gzip->finish();
+                        queue->push(reinterpret_cast<const char *>(out.data()), out.size());
+                    }
+                    queue->finish(OB::Belle::Status::ok);
+                }
+                catch (...)
+                {
+                    queue->finish(OB::Belle::Status::internal_server_error);
+                }
+            });
+        }
+
+        // Sends large cached renders gzip encoded with chunked transfer
+        // encoding. Chunks are compressed on the session strand as the
+        // previous one has been written, the render is kept alive until then.
+        template <typename T>
+        static inline bool set_body_chunked(T &ctx, const HttpgdServerConfig &t_conf, std::shared_ptr<const std::string> t_body)
+        {
+            if (t_conf.compression_level <= 0 || t_body->size() < stream_min_size)
+            {
+                return false;
+            }
+            ctx.res.set(OB::Belle::Header::vary, "Accept-Encoding");
+            const auto accept = ctx.req[OB::Belle::Header::accept_encoding];
+            if (negotiate_encoding(std::string(accept.data(), accept.size())) != "gzip")
+            {
+                return false;
+            }
+            ctx.res.set(OB::Belle::Header::content_encoding, "gzip");
+            weaken_etag(ctx);
+
+            auto gzip = std::make_shared<compr::GzipStream>(std::min(9, t_conf.compression_level));
+            ctx.body_chunks = [gzip, body = std::move(t_body), offset = std::size_t{0}](ChunkQueue::callback_t t_next) mutable {
+                std::vector<unsigned char> out;
+                while (out.empty() && gzip)
+                {
+                    if (offset < body->size())
+                    {
+                        const auto size = std::min(stream_chunk_size, body->size() - offset);
+                        gzip->write(body->data() + offset, size);
+                        offset += size;
+                        out = gzip->take();
+                    }
+                    else
+                    {
+                        out = gzip->finish();
+                        gzip.reset();
+                    }
+                }
+                t_next(std::string(out.begin(), out.end()), OB::Belle::Status::ok);
+            };
+            return true;
+        }
+
+        // Sends renders (which may be cached) without copying them into the
+        // response, unless they are compressed.
+        template <typename T>
+        static inline void set_body(T &ctx, const HttpgdServerConfig &t_conf, std::shared_ptr<const std::string> t_body)
+        {
+            if (set_body_chunked(ctx, t_conf, t_body))
+            {
+                return;
+            }
+            auto encoded = encode_body(ctx, t_conf, *t_body);
+            if (encoded)
+            {
+                ctx.res.body() = std::move(*encoded);
+            }
+            else
+            {
+                ctx.body_shared(std::move(t_body));
+            }
+        }
+
+        // Edge length of /tile images (pixels) and highest tile zoom level.
+        constexpr int tile_size = 256;
+        constexpr int tile_max_level = 10;
+
         template<typename T>
         static inline bool authorized(std::shared_ptr<httpgd::HttpgdServerConfig> &m_conf, T &ctx)
         {
@@ -141,7 +611,9 @@ namespace httpgd
         WebServer::WebServer(std::shared_ptr<HttpgdApiAsync> t_watcher)
             : m_watcher(t_watcher),
               m_conf(t_watcher->api_server_config()),
-              m_app()
+              m_app(),
+              m_broadcast_strand(net::make_strand(m_app.io())),
+              m_broadcast_timer(m_broadcast_strand)
         {
         }
 
@@ -171,12 +643,14 @@ namespace httpgd
                 headers.set(OB::Belle::Header::access_control_allow_origin, "*");
                 headers.set(OB::Belle::Header::access_control_allow_methods, "GET, POST, PATCH, PUT, DELETE, OPTIONS");
                 headers.set(OB::Belle::Header::access_control_allow_headers, "Origin, Content-Type, X-Auth-Token, X-HTTPGD-TOKEN");
+                headers.set(OB::Belle::Header::access_control_expose_headers, "ETag, X-HTTPGD-PROVISIONAL");
             }
             m_app.http_headers(headers);
 
             m_app.public_dir(m_conf->wwwpath);
 
             m_app.websocket(true);
+            m_app.threads(std::max(1, m_conf->threads));
             m_app.signals({SIGINT, SIGTERM});
             // set the on signal callback
             m_app.on_signal([&](auto ec, auto sig) {
@@ -187,6 +661,9 @@ namespace httpgd
                 m_app.io().stop();
             });
             m_app.channels()["/"] = OB::Belle::Server::Channel();
+            // references to map elements stay valid, this avoids looking
+            // up the channel while sessions join from other threads
+            m_state_channel = &m_app.channels().at("/");
 
             m_app.on_http("/", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx &ctx) {
                 if (!authorized(m_conf, ctx))
@@ -214,8 +691,8 @@ namespace httpgd
                 ctx.res.result(OB::Belle::Status::ok);
 
                 std::string filepath = m_app.public_dir() + "/index.html";
-                ctx.res.body() = read_txt(filepath).get_value_or(
-                    fmt::format("<html><body><b>ERROR:</b> File not found ({}).<br>Please reload package.</body></html>", filepath));
+                set_body(ctx, *m_conf, read_txt(filepath).get_value_or(
+                    fmt::format("<html><body><b>ERROR:</b> File not found ({}).<br>Please reload package.</body></html>", filepath)));
             });
 
             m_app.on_http("/info", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx &ctx) {
@@ -227,7 +704,7 @@ namespace httpgd
                 ctx.res.set("content-type", "application/json");
                 ctx.res.result(OB::Belle::Status::ok);
 
-                ctx.res.body() = json_make_info(m_conf);
+                set_body(ctx, *m_conf, json_make_info(m_conf));
             });
 
             m_app.on_http("/state", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx &ctx) {
@@ -239,7 +716,11 @@ namespace httpgd
                 ctx.res.set("content-type", "application/json");
                 ctx.res.result(OB::Belle::Status::ok);
 
-                ctx.res.body() = json_make_state(m_watcher->api_state());
+                const auto body = json_make_state(m_watcher->api_state());
+                if (!not_modified(ctx, body_etag(body)))
+                {
+                    set_body(ctx, *m_conf, body);
+                }
             });
 
             m_app.on_http("/renderers", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx &ctx) {
@@ -286,7 +767,7 @@ namespace httpgd
                 
                 fmt::format_to(std::back_inserter(buf), "\n ]\n}}");
 
-                ctx.res.body() = fmt::to_string(buf);
+                set_body(ctx, *m_conf, fmt::to_string(buf));
             });
 
             m_app.on_http("/plots", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx &ctx) {
@@ -331,7 +812,11 @@ namespace httpgd
 
                 ctx.res.set("content-type", "application/json");
                 ctx.res.result(OB::Belle::Status::ok);
-                ctx.res.body() = buf.str();
+                const auto body = buf.str();
+                if (!not_modified(ctx, body_etag(body)))
+                {
+                    set_body(ctx, *m_conf, body);
+                }
             });
 
             m_app.on_http("/svg", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx &ctx) {
@@ -357,6 +842,11 @@ namespace httpgd
                     height = p_height.get_value_or(-1);
                 }
                 auto p_id = param_long(qparams, "id");
+                const auto options = param_render_options(qparams, *m_conf);
+                if (!options)
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
 
                 boost::optional<int> index;
                 if (p_id)
@@ -372,9 +862,32 @@ namespace httpgd
                 {
                     ctx.res.set("content-type", "image/svg+xml");
                     ctx.res.result(OB::Belle::Status::ok);
-                    dc::RendererSVG renderer(boost::none);
-                    if (m_watcher->api_render(*index, width, height, &renderer, zoom)) {
-                        ctx.res.body() = renderer.get_string();
+                    const auto &renderer = *RendererManager::defaults().find_string("svg");
+                    // the version has to be read before rendering, a page
+                    // changing in between must not be labeled with a newer ETag
+                    const auto version = m_watcher->api_version(*index, width, height);
+                    if (version && not_modified(ctx, plot_etag(*m_conf, *version, zoom, renderer.id, *options)))
+                    {
+                        return;
+                    }
+                    const auto p_provisional = param_str(qparams, "provisional");
+                    const bool allow_provisional = p_provisional && (*p_provisional == "1" || *p_provisional == "true");
+                    if (!allow_provisional && version && version->draw_calls >= stream_min_draw_calls)
+                    {
+                        render_streamed(ctx, m_app.io(), *m_conf, [watcher = m_watcher, index = *index, width, height, &renderer, zoom, options = *options](const dc::StringRenderingTarget::sink_t &t_sink) {
+                            return watcher->api_render_string(index, width, height, renderer, zoom, options, t_sink, stream_chunk_size) != nullptr;
+                        });
+                        return;
+                    }
+                    bool provisional = false;
+                    const auto rendered = allow_provisional
+                                              ? m_watcher->api_render_string_provisional(*index, width, height, renderer, zoom, *options, provisional)
+                                              : m_watcher->api_render_string(*index, width, height, renderer, zoom, *options);
+                    if (rendered) {
+                        if (provisional) {
+                            set_provisional(ctx);
+                        }
+                        set_body(ctx, *m_conf, rendered);
                     } else {
                         throw OB::Belle::Status::not_found;
                     }
@@ -410,6 +923,11 @@ namespace httpgd
                 auto p_id = param_long(qparams, "id");
                 auto p_renderer = param_str(qparams, "renderer").get_value_or("svg");
                 auto p_download = param_str(qparams, "download");
+                const auto options = param_render_options(qparams, *m_conf);
+                if (!options)
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
 
                 boost::optional<int> index;
                 if (p_id)
@@ -430,13 +948,39 @@ namespace httpgd
                     if (!find_renderer) {
                         throw OB::Belle::Status::not_found;
                     }
-                    const auto renderer = (*find_renderer).renderer();
-                    if (m_watcher->api_render(*index, width, height, renderer.get(), zoom)) {
+                    const auto version = m_watcher->api_version(*index, width, height);
+                    if (version && not_modified(ctx, plot_etag(*m_conf, *version, zoom, (*find_renderer).id, *options)))
+                    {
+                        ctx.res.set("content-type", (*find_renderer).mime);
+                        return;
+                    }
+                    const auto p_provisional = param_str(qparams, "provisional");
+                    const bool allow_provisional = p_provisional && (*p_provisional == "1" || *p_provisional == "true");
+                    if (!allow_provisional && version && version->draw_calls >= stream_min_draw_calls)
+                    {
+                        ctx.res.set("content-type", (*find_renderer).mime);
+                        if (p_download) {
+                            ctx.res.set("Content-Disposition", fmt::format("attachment; filename=\"{}\"", *p_download));
+                        }
+                        const StringRendererInfo &renderer = *find_renderer;
+                        render_streamed(ctx, m_app.io(), *m_conf, [watcher = m_watcher, index = *index, width, height, &renderer, zoom, options = *options](const dc::StringRenderingTarget::sink_t &t_sink) {
+                            return watcher->api_render_string(index, width, height, renderer, zoom, options, t_sink, stream_chunk_size) != nullptr;
+                        });
+                        return;
+                    }
+                    bool provisional = false;
+                    const auto rendered = allow_provisional
+                                              ? m_watcher->api_render_string_provisional(*index, width, height, *find_renderer, zoom, *options, provisional)
+                                              : m_watcher->api_render_string(*index, width, height, *find_renderer, zoom, *options);
+                    if (rendered) {
+                        if (provisional) {
+                            set_provisional(ctx);
+                        }
                         ctx.res.set("content-type", (*find_renderer).mime);
                         if (p_download) {
                             ctx.res.set("Content-Disposition", fmt::format("attachment; filename=\"{}\"", *p_download));
                         }
-                        ctx.res.body() = renderer->get_string();
+                        set_body(ctx, *m_conf, rendered);
                     } else {
                         throw OB::Belle::Status::not_found;
                     }
@@ -471,6 +1015,11 @@ namespace httpgd
                 auto p_id = param_long(qparams, "id");
                 auto p_renderer = param_str(qparams, "renderer").get_value_or("png");
                 auto p_download = param_str(qparams, "download");
+                const auto options = param_render_options(qparams, *m_conf);
+                if (!options)
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
 
                 boost::optional<int> index;
                 if (p_id)
@@ -490,8 +1039,21 @@ namespace httpgd
                     if (!find_renderer) {
                         throw OB::Belle::Status::not_found;
                     }
-                    const auto renderer = (*find_renderer).renderer();
-                    if (m_watcher->api_render(*index, width, height, renderer.get(), zoom)) {
+                    const auto version = m_watcher->api_version(*index, width, height);
+                    if (version && not_modified(ctx, plot_etag(*m_conf, *version, zoom, (*find_renderer).id, *options)))
+                    {
+                        ctx.res.set("content-type", (*find_renderer).mime);
+                        return;
+                    }
+                    const auto p_provisional = param_str(qparams, "provisional");
+                    bool provisional = false;
+                    const auto rendered = (p_provisional && (*p_provisional == "1" || *p_provisional == "true"))
+                                              ? m_watcher->api_render_binary_provisional(*index, width, height, *find_renderer, zoom, *options, provisional)
+                                              : m_watcher->api_render_binary(*index, width, height, *find_renderer, zoom, *options);
+                    if (rendered) {
+                        if (provisional) {
+                            set_provisional(ctx);
+                        }
                         ctx.res.set("content-type", (*find_renderer).mime);
                         if ((*find_renderer).id.rfind("svgz", 0) == 0) {
                             ctx.res.set("Content-Encoding", "gzip"); // todo
@@ -499,7 +1061,7 @@ namespace httpgd
                         if (p_download) {
                             ctx.res.set("Content-Disposition", fmt::format("attachment; filename=\"{}\"", *p_download));
                         }
-                        ctx.res.body() = renderer->get_binary();
+                        ctx.body_shared(rendered);
                     } else {
                         throw OB::Belle::Status::not_found;
                     }
@@ -510,6 +1072,126 @@ namespace httpgd
                 }
             });
 
+            m_app.on_http("/tile", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx_dyn &ctx) {
+                if (!authorized(m_conf, ctx))
+                {
+                    throw OB::Belle::Status::unauthorized;
+                }
+
+                // Tiles of a plot at zoom level z cover the plot rendered at
+                // 2^z times its size, tile (x, y) starts at pixel
+                // (x * tile_size, y * tile_size).
+                auto qparams = ctx.req.params();
+                const double width = param_double(qparams, "width").get_value_or(-1);
+                const double height = param_double(qparams, "height").get_value_or(-1);
+                const auto p_z = param_int(qparams, "z");
+                const auto p_x = param_int(qparams, "x");
+                const auto p_y = param_int(qparams, "y");
+                if (!p_z || !p_x || !p_y || *p_z < 0 || *p_z > tile_max_level || *p_x < 0 || *p_y < 0)
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
+                auto options = param_render_options(qparams, *m_conf);
+                if (!options)
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
+
+                auto p_id = param_long(qparams, "id");
+                boost::optional<int> index;
+                if (p_id)
+                {
+                    index = m_watcher->api_index(*p_id);
+                }
+                else
+                {
+                    index = param_int(qparams, "index").get_value_or(-1);
+                }
+                if (!index)
+                {
+                    throw OB::Belle::Status::not_found;
+                }
+
+                const auto find_renderer = RendererManager::defaults().find_binary("png");
+                if (!find_renderer)
+                {
+                    throw OB::Belle::Status::not_found;
+                }
+
+                const double scale = std::ldexp(1.0, *p_z);
+                const double tile_extent = tile_size / scale; // in plot coordinates
+                const auto version = m_watcher->api_version(*index, width, height);
+                const double plot_width = (width > 0) ? width : (version ? version->width : 0);
+                const double plot_height = (height > 0) ? height : (version ? version->height : 0);
+                if (*p_x * tile_extent >= plot_width || *p_y * tile_extent >= plot_height)
+                {
+                    throw OB::Belle::Status::not_found;
+                }
+                options->viewport = grect<double>{*p_x * tile_extent, *p_y * tile_extent, tile_extent, tile_extent};
+
+                ctx.res.result(OB::Belle::Status::ok);
+                ctx.res.set("content-type", (*find_renderer).mime);
+                if (version && not_modified(ctx, plot_etag(*m_conf, *version, scale, (*find_renderer).id, *options)))
+                {
+                    return;
+                }
+                // Tiles are cached in the render cache like any other render,
+                // keyed by page version, scale (zoom level) and viewport (tile).
+                const auto rendered = m_watcher->api_render_binary(*index, width, height, *find_renderer, scale, *options);
+                if (!rendered)
+                {
+                    throw OB::Belle::Status::not_found;
+                }
+                ctx.body_shared(rendered);
+            });
+            m_app.on_http("/raster", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx_dyn &ctx) {
+                if (!authorized(m_conf, ctx))
+                {
+                    throw OB::Belle::Status::unauthorized;
+                }
+
+                auto qparams = ctx.req.params();
+                const auto p_id = param_long(qparams, "id");
+                const auto p_hash = param_str(qparams, "hash");
+                if (!p_id || !p_hash)
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
+                std::uint64_t hash;
+                try
+                {
+                    hash = std::stoull(*p_hash, nullptr, 16);
+                }
+                catch (const std::exception &e)
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
+                // Dense layers also have "scale", "cull" and "viewport"
+                const auto options = param_render_options(qparams, *m_conf);
+                const auto scale = param_double(qparams, "scale").get_value_or(1);
+                if (!options || !(scale > 0))
+                {
+                    throw OB::Belle::Status::bad_request;
+                }
+
+                const auto index = m_watcher->api_index(*p_id);
+                if (!index)
+                {
+                    throw OB::Belle::Status::not_found;
+                }
+                const auto png = m_watcher->api_raster(*index, hash, scale, *options);
+                if (!png || png->empty())
+                {
+                    throw OB::Belle::Status::not_found;
+                }
+
+                // The hash covers everything the image depends on, so the
+                // same URL always yields the same image.
+                ctx.res.result(OB::Belle::Status::ok);
+                ctx.res.set("content-type", "image/png");
+                ctx.res.set(OB::Belle::Header::cache_control, "public, max-age=31536000, immutable");
+                ctx.body_shared(png);
+            });
             m_app.on_http("/remove", OB::Belle::Method::get, [&](OB::Belle::Server::Http_Ctx &ctx) {
                 if (!authorized(m_conf, ctx))
                 {
@@ -574,13 +1256,47 @@ namespace httpgd
             // handle ws connections to index room '/'
             m_app.on_websocket("/",
                                // on data: called after every websocket read
-                               [](OB::Belle::Server::Websocket_Ctx &ctx) {
-                                   // register the route
-                                   // data will be broadcasted in the websocket connect and disconnect handlers
-                                   //ctx.send("test1");
-                                   //ctx.broadcast("test2");
+                               [&](OB::Belle::Server::Websocket_Ctx &ctx) {
+                                   // state changes are broadcasted to all connections,
+                                   // clients can request page deltas with messages of the form
+                                   // "/delta?id=<plot id>&since=<draw call seq>"
+                                   if (ctx.msg.rfind("/delta", 0) != 0)
+                                   {
+                                       return;
+                                   }
+                                   OB::Belle::Request msg_req;
+                                   msg_req.target(ctx.msg);
+                                   msg_req.params_parse();
+                                   const auto &qparams = msg_req.params();
+
+                                   if (m_conf->use_token && param_str(qparams, "token") != m_conf->token)
+                                   {
+                                       return;
+                                   }
+                                   const auto p_id = param_long(qparams, "id");
+                                   const auto p_since = param_long(qparams, "since");
+                                   if (!p_id || !p_since || *p_since < 0)
+                                   {
+                                       return;
+                                   }
+                                   const auto index = m_watcher->api_index(*p_id);
+                                   if (!index)
+                                   {
+                                       return;
+                                   }
+                                   // render at the current page size
+                                   dc::RendererJSON renderer(static_cast<std::uint64_t>(*p_since));
+                                   if (m_watcher->api_render(*index, -1, -1, &renderer, 1))
+                                   {
+                                       ctx.send(renderer.get_string());
+                                   }
                                });
 
+            // called on the R thread when a deferred replay has finished
+            m_watcher->broadcast_notify_change = [this]() {
+                broadcast_state_current();
+            };
+
             m_server_thread = std::thread(&WebServer::run, this);
 
             return true;
@@ -593,6 +1309,7 @@ namespace httpgd
 
         void WebServer::stop()
         {
+            m_watcher->broadcast_notify_change = nullptr;
             // todo: send SIGINT/SIGTERM for clean shutdown?
             m_app.io().stop();
             if (m_server_thread.joinable())
@@ -603,9 +1320,13 @@ namespace httpgd
 
         void WebServer::broadcast_state(const HttpgdState &state)
         {
+            const std::lock_guard<std::mutex> lock(m_broadcast_mutex);
             if (state.upid != m_last_upid || state.active != m_last_active)
             {
-                m_app.channels().at("/").broadcast(json_make_state(state));
+                if (m_state_channel)
+                {
+                    m_state_channel->broadcast(json_make_state(state));
+                }
                 m_last_upid = state.upid;
                 m_last_active = state.active;
             }
@@ -613,8 +1334,37 @@ namespace httpgd
 
         void WebServer::broadcast_state_current()
         {
-            HttpgdState state = m_watcher->api_state();
-            broadcast_state(state);
+            // do not block the caller (usually the R thread), the state is
+            // fetched on the server thread once the update is due
+            net::post(m_broadcast_strand, [this]() { m_schedule_broadcast(); });
+        }
+
+        void WebServer::m_schedule_broadcast()
+        {
+            if (m_broadcast_pending)
+            {
+                return; // trailing update will pick up this change
+            }
+            const auto interval = std::chrono::milliseconds(std::max(0, m_conf->update_interval));
+            const auto now = std::chrono::steady_clock::now();
+            if (now - m_last_broadcast >= interval)
+            {
+                m_last_broadcast = now;
+                broadcast_state(m_watcher->api_state());
+                return;
+            }
+
+            m_broadcast_pending = true;
+            m_broadcast_timer.expires_at(m_last_broadcast + interval);
+            m_broadcast_timer.async_wait(net::bind_executor(m_broadcast_strand, [this](const boost::system::error_code &ec) {
+                m_broadcast_pending = false;
+                if (ec)
+                {
+                    return;
+                }
+                m_last_broadcast = std::chrono::steady_clock::now();
+                broadcast_state(m_watcher->api_state());
+            }));
         }
 
     } // namespace web
@@ -1,7 +1,9 @@
 #ifndef HTTPGD_WEB_TASK_H
 #define HTTPGD_WEB_TASK_H
 
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <belle.h>
 #include "HttpgdApiAsync.h"
 #include <thread>
@@ -29,11 +31,20 @@ namespace httpgd
             std::shared_ptr<HttpgdApiAsync> m_watcher;
             std::shared_ptr<HttpgdServerConfig> m_conf;
             OB::Belle::Server m_app;
+            OB::Belle::Server::Channel *m_state_channel = nullptr;
+            std::mutex m_broadcast_mutex;
             int m_last_upid = -1;
             bool m_last_active = true;
             std::thread m_server_thread;
 
+            // state update coalescing, only touched on m_broadcast_strand
+            net::strand<net::io_context::executor_type> m_broadcast_strand;
+            net::steady_timer m_broadcast_timer;
+            std::chrono::steady_clock::time_point m_last_broadcast{};
+            bool m_broadcast_pending = false;
+
             void run();
+            void m_schedule_broadcast();
         };
     } // namespace web
 } // namespace httpgd
@@ -2,6 +2,9 @@
 
 #ifndef HTTPGD_NO_CAIRO
 
+#include "SpatialIndex.h"
+
+#include <algorithm>
 #include <boost/math/constants/constants.hpp>
 #include <cairo-pdf.h>
 //#include <cairo-svg.h>
@@ -9,6 +12,8 @@
 
 #include <tiffio.hxx>
 
+#include <cmath>
+
 // Implementation based on grDevices::cairo
 // https://github.com/wch/r-source/blob/trunk/src/library/grDevices/src/cairo/cairoFns.c
 
@@ -85,9 +90,17 @@ namespace httpgd::dc
         }
     }
 
-    void RendererCairo::page(const Page &t_page)
+    RendererCairo::RendererCairo(const RenderOptions &t_options)
+        : m_cull(t_options.cull), m_viewport(t_options.viewport)
     {
+    }
 
+    void RendererCairo::page(const Page &t_page)
+    {
+        if (m_viewport)
+        {
+            cairo_translate(cr, -m_viewport->x, -m_viewport->y);
+        }
 
         if (!color::transparent(t_page.fill))
         {
@@ -97,30 +110,50 @@ namespace httpgd::dc
             cairo_fill(cr);
         }
 
-        const auto &first_clip = t_page.cps.front();
-        cairo_new_path(cr);
-        cairo_rectangle(cr, first_clip.rect.x, first_clip.rect.y, first_clip.rect.width, first_clip.rect.height);
-        cairo_clip(cr);
-        auto last_clip_id = first_clip.id;
-        for (const auto &dc : t_page.dcs)
+        const VisibleDrawCalls dcs(t_page, m_viewport);
+        m_draw_calls(t_page, dcs.begin(), dcs.end());
+    }
+
+    grect<double> RendererCairo::m_area(const Page &t_page) const
+    {
+        return render_area(t_page, m_viewport);
+    }
+
+    void RendererCairo::m_draw_calls(const Page &t_page, DrawCallIterator t_first, DrawCallIterator t_last)
+    {
+        if (t_first == t_last)
+        {
+            return;
+        }
+        auto last_clip_id = t_first->clip_id;
+        m_clip(t_page, last_clip_id);
+        for (auto it = t_first; it != t_last; ++it)
         {
-            if (dc->clip_id != last_clip_id)
+            const auto &dc = *it;
+            if (m_cull.skip(t_page, dc))
+            {
+                continue;
+            }
+            if (dc.clip_id != last_clip_id)
             {
-                const auto &next_clip = *std::find_if(t_page.cps.begin(), t_page.cps.end(), [&](const Clip &clip) {
-                    return clip.id == dc->clip_id;
-                });
-
                 cairo_reset_clip(cr); // todo: cairo docs discourages this (but R grDevices does it)
-                cairo_new_path(cr);
-                cairo_rectangle(cr, next_clip.rect.x, next_clip.rect.y, next_clip.rect.width, next_clip.rect.height);
-                cairo_clip(cr);
-
-                last_clip_id = next_clip.id;
+                m_clip(t_page, dc.clip_id);
+                last_clip_id = dc.clip_id;
             }
-            dc->render(this);
+            t_page.render(dc, this);
         }
     }
 
+    void RendererCairo::m_clip(const Page &t_page, clip_id_t t_clip_id)
+    {
+        const auto &clip = *std::find_if(t_page.cps.begin(), t_page.cps.end(), [&](const Clip &c) {
+            return c.id == t_clip_id;
+        });
+        cairo_new_path(cr);
+        cairo_rectangle(cr, clip.rect.x, clip.rect.y, clip.rect.width, clip.rect.height);
+        cairo_clip(cr);
+    }
+
 
     void RendererCairo::rect(const Rect &t_rect)
     {
@@ -378,12 +411,13 @@ namespace httpgd::dc
     
     void RendererCairoPng::render(const Page &t_page, double t_scale) 
     {
-        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, t_page.size.x * t_scale, t_page.size.y * t_scale);
+        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, m_area(t_page).width * t_scale, m_area(t_page).height * t_scale);
 
         cr = cairo_create(surface);
         
         cairo_scale(cr, t_scale, t_scale);
 
+        m_cull.begin(t_page, t_scale);
         page(t_page);
 
         cairo_surface_write_to_png_stream(surface, cairowrite_ucvec, &m_render_data);
@@ -396,15 +430,23 @@ namespace httpgd::dc
     {
         return m_render_data;
     }
+
+    std::vector<unsigned char> RendererCairoPng::take_binary()
+    {
+        std::vector<unsigned char> out;
+        out.swap(m_render_data);
+        return out;
+    }
     
     void RendererCairoPdf::render(const Page &t_page, double t_scale) 
     {
-        surface = cairo_pdf_surface_create_for_stream(cairowrite_ucvec, &m_render_data, t_page.size.x * t_scale, t_page.size.y * t_scale);
+        surface = cairo_pdf_surface_create_for_stream(cairowrite_ucvec, &m_render_data, m_area(t_page).width * t_scale, m_area(t_page).height * t_scale);
 
         cr = cairo_create(surface);
 
         cairo_scale(cr, t_scale, t_scale);
 
+        m_cull.begin(t_page, t_scale);
         page(t_page);
 
         cairo_destroy(cr);
@@ -415,15 +457,23 @@ namespace httpgd::dc
     {
         return m_render_data;
     }
+
+    std::vector<unsigned char> RendererCairoPdf::take_binary()
+    {
+        std::vector<unsigned char> out;
+        out.swap(m_render_data);
+        return out;
+    }
     
     void RendererCairoPs::render(const Page &t_page, double t_scale) 
     {
-        surface = cairo_ps_surface_create_for_stream(cairowrite_fmt, &m_os, t_page.size.x * t_scale, t_page.size.y * t_scale);
+        surface = cairo_ps_surface_create_for_stream(cairowrite_fmt, &m_os, m_area(t_page).width * t_scale, m_area(t_page).height * t_scale);
         
         cr = cairo_create(surface);
         
         cairo_scale(cr, t_scale, t_scale);
 
+        m_cull.begin(t_page, t_scale);
         page(t_page);
 
         cairo_destroy(cr);
@@ -437,13 +487,14 @@ namespace httpgd::dc
     
     void RendererCairoEps::render(const Page &t_page, double t_scale) 
     {
-        surface = cairo_ps_surface_create_for_stream(cairowrite_fmt, &m_os, t_page.size.x * t_scale, t_page.size.y * t_scale);
+        surface = cairo_ps_surface_create_for_stream(cairowrite_fmt, &m_os, m_area(t_page).width * t_scale, m_area(t_page).height * t_scale);
         cairo_ps_surface_set_eps(surface, true);
         
         cr = cairo_create(surface);
         
         cairo_scale(cr, t_scale, t_scale);
 
+        m_cull.begin(t_page, t_scale);
         page(t_page);
 
         cairo_destroy(cr);
@@ -455,12 +506,35 @@ namespace httpgd::dc
         return fmt::to_string(m_os);
     }
     
+    std::vector<unsigned char> RendererCairoLayer::render(const Page &t_page, DrawCallIterator t_first, DrawCallIterator t_last,
+                                                          grect<double> t_rect, double t_scale)
+    {
+        std::vector<unsigned char> render_data;
+        const int width = std::max(1, static_cast<int>(std::ceil(t_rect.width * t_scale)));
+        const int height = std::max(1, static_cast<int>(std::ceil(t_rect.height * t_scale)));
+        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+
+        cr = cairo_create(surface);
+
+        cairo_scale(cr, t_scale, t_scale);
+        cairo_translate(cr, -t_rect.x, -t_rect.y);
+
+        m_cull.begin(t_page, t_scale);
+        m_draw_calls(t_page, t_first, t_last);
+
+        cairo_surface_write_to_png_stream(surface, cairowrite_ucvec, &render_data);
+
+        cairo_destroy(cr);
+        cairo_surface_destroy(surface);
+        return render_data;
+    }
+
     // see: https://research.cs.wisc.edu/graphics/Courses/638-f1999/libtiff_tutorial.htm
     void RendererCairoTiff::render(const Page &t_page, double t_scale)
     {
         const int argb_size = 4;
-        const int width = t_page.size.x * t_scale;
-        const int height = t_page.size.y * t_scale;
+        const int width = m_area(t_page).width * t_scale;
+        const int height = m_area(t_page).height * t_scale;
         const int stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width);
 
         std::vector<unsigned char> raw_buffer(stride * height);
@@ -468,6 +542,7 @@ namespace httpgd::dc
 
         cr = cairo_create(surface);
         cairo_scale(cr, t_scale, t_scale);
+        m_cull.begin(t_page, t_scale);
         page(t_page);
 
         std::ostringstream tiff_ostream;
@@ -514,6 +589,13 @@ namespace httpgd::dc
     {
         return m_render_data;
     }
+
+    std::vector<unsigned char> RendererCairoTiff::take_binary()
+    {
+        std::vector<unsigned char> out;
+        out.swap(m_render_data);
+        return out;
+    }
     
 
 } // namespace httpgd::dc
@@ -3,6 +3,7 @@
 
 #ifndef HTTPGD_NO_CAIRO
 
+#include "Cull.h"
 #include "DrawData.h"
 
 #include <cairo.h>
@@ -14,6 +15,9 @@ namespace httpgd::dc
     class RendererCairo : public Renderer
     {
     public:
+        using DrawCallIterator = std::vector<DrawCall>::const_iterator;
+
+        explicit RendererCairo(const RenderOptions &t_options = {});
         void page(const Page &t_page) override;
         void rect(const Rect &t_rect) override;
         void text(const Text &t_text) override;
@@ -27,14 +31,24 @@ namespace httpgd::dc
     protected:
         cairo_surface_t *surface = nullptr;
         cairo_t *cr = nullptr;
+        Culler m_cull;
+        boost::optional<grect<double>> m_viewport;
+
+        // Area of the page that is rendered
+        [[nodiscard]] grect<double> m_area(const Page &t_page) const;
+        // Draws a range of the draw calls of t_page, without background.
+        void m_draw_calls(const Page &t_page, DrawCallIterator t_first, DrawCallIterator t_last);
+        void m_clip(const Page &t_page, clip_id_t t_clip_id);
     };
 
     class RendererCairoPng : public BinaryRenderingTarget, public RendererCairo
     {
     public:
+        using RendererCairo::RendererCairo;
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::vector<unsigned char> get_binary() const override;
+        std::vector<unsigned char> take_binary() override;
         
     private:
         std::vector<unsigned char> m_render_data{};
@@ -43,9 +57,11 @@ namespace httpgd::dc
     class RendererCairoPdf : public BinaryRenderingTarget, public RendererCairo
     {
     public:
+        using RendererCairo::RendererCairo;
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::vector<unsigned char> get_binary() const override;
+        std::vector<unsigned char> take_binary() override;
         
     private:
         std::vector<unsigned char> m_render_data{};
@@ -54,6 +70,7 @@ namespace httpgd::dc
     class RendererCairoPs : public StringRenderingTarget, public RendererCairo
     {
     public:
+        using RendererCairo::RendererCairo;
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::string get_string() const override;
@@ -65,6 +82,7 @@ namespace httpgd::dc
     class RendererCairoEps : public StringRenderingTarget, public RendererCairo
     {
     public:
+        using RendererCairo::RendererCairo;
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::string get_string() const override;
@@ -73,12 +91,27 @@ namespace httpgd::dc
         fmt::memory_buffer m_os;
     };
 
+    /**
+     * Renders a range of draw calls to a PNG image with transparent
+     * background, covering the rectangle t_rect (page units) at t_scale.
+     * Used to embed dense parts of a page in vector output.
+     */
+    class RendererCairoLayer : public RendererCairo
+    {
+    public:
+        using RendererCairo::RendererCairo;
+        std::vector<unsigned char> render(const Page &t_page, DrawCallIterator t_first, DrawCallIterator t_last,
+                                          grect<double> t_rect, double t_scale);
+    };
+
     class RendererCairoTiff : public BinaryRenderingTarget, public RendererCairo
     {
     public:
+        using RendererCairo::RendererCairo;
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::vector<unsigned char> get_binary() const override;
+        std::vector<unsigned char> take_binary() override;
         
     private:
         std::vector<unsigned char> m_render_data{};
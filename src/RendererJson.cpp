@@ -1,38 +1,50 @@
 #include "RendererJson.h"
 
 #include "Base64.h"
+#include "SpatialIndex.h"
+#include "TextWriter.h"
 
 namespace httpgd::dc
 {
 
-    static inline std::string hexcol(color_t t_color)
+    static inline void json_lineinfo(fmt::memory_buffer &os, const LineInfo &t_line)
     {
-        return fmt::format("#{:02X}{:02X}{:02X}", color::red(t_color), color::green(t_color), color::blue(t_color));
+        write_to(os, R""({ "col": ")"", hex_color(t_line.col), R""(", "lwd": )"", fixed2(t_line.lwd), R""(, "lty": )"", t_line.lty,
+                 R""(, "lend": )"", static_cast<int>(t_line.lend), R""(, "ljoin": )"", static_cast<int>(t_line.ljoin), R""(, "lmitre": )"");
+        fmt::format_to(std::back_inserter(os), "{} }}", t_line.lmitre);
     }
 
-    static inline std::string json_lineinfo(const LineInfo &t_line)
+    static inline void json_verts(fmt::memory_buffer &os, const Span<httpgd::gvertex<double>> &t_verts, const CoordFormat &t_coord)
     {
-        return fmt::format(R""({{ "col": "{}", "lwd": {:.2f}, "lty": {}, "lend": {}, "ljoin": {}, "lmitre": {} }})"",
-                           hexcol(t_line.col), t_line.lwd, t_line.lty, t_line.lend, t_line.ljoin, t_line.lmitre);
-    }
-
-    static inline void json_verts(fmt::memory_buffer &os, const std::vector<httpgd::gvertex<double>> &t_verts)
-    {
-        fmt::format_to(std::back_inserter(os), "[");
+        write_to(os, "[");
         for (auto it = t_verts.begin(); it != t_verts.end(); ++it)
         {
             if (it != t_verts.begin())
             {
-                fmt::format_to(std::back_inserter(os), ", ");
+                write_to(os, ", ");
             }
-            fmt::format_to(std::back_inserter(os), "[ {:.2f}, {:.2f} ]", it->x, it->y);
+            write_to(os, "[ ", t_coord(it->x), ", ", t_coord(it->y), " ]");
         }
-        fmt::format_to(std::back_inserter(os), "]");
+        write_to(os, "]");
+    }
+
+    RendererJSON::RendererJSON(const RenderOptions &t_options)
+        : m_coord(RenderOptions{t_options.precision, false}), // integer coordinates are SVG only
+          m_simplify(t_options.simplify), m_cull(t_options.cull), m_viewport(t_options.viewport),
+          m_fast_png(t_options.fast_png)
+    {
+    }
+
+    RendererJSON::RendererJSON(std::uint64_t t_since)
+        : m_since(t_since)
+    {
     }
 
     void RendererJSON::render(const Page &t_page, double t_scale)
     {
         m_scale = t_scale;
+        m_simplify.set_scale(t_scale);
+        m_cull.begin(t_page, t_scale);
         page(t_page);
     }
 
@@ -41,102 +53,151 @@ namespace httpgd::dc
         return fmt::to_string(os);
     }
 
+    std::string RendererJSON::take_string()
+    {
+        auto out = fmt::to_string(os);
+        os = fmt::memory_buffer(); // release the buffer right away
+        return out;
+    }
+
     void RendererJSON::page(const Page &t_page)
     {
-        fmt::format_to(std::back_inserter(os), "{{\n " R""("id": "{}", "w": {:.2f}, "h": {:.2f}, "scale": {:.2f}, "fill": "{}",)"" "\n",
-        t_page.id, t_page.size.x, t_page.size.y, m_scale, hexcol(t_page.fill));
-        fmt::format_to(std::back_inserter(os), " \"clips\": [\n  ");
+        write_to(os, "{\n \"id\": \"", t_page.id, "\", \"w\": ", m_coord(t_page.size.x), ", \"h\": ", m_coord(t_page.size.y),
+                 ", \"scale\": ", fixed2(m_scale), ", \"fill\": \"", hex_color(t_page.fill), "\",\n");
+        auto first_dc = t_page.dcs.begin();
+        if (m_since && t_page.has_dcs_since(*m_since))
+        {
+            write_to(os, R""( "since": )"", *m_since, ",\n");
+            first_dc += *m_since - t_page.dc_seq_base;
+        }
+        write_to(os, R""( "seq": )"", t_page.dc_seq, ",\n");
+        if (m_viewport)
+        {
+            write_to(os, R""( "viewport": { "x": )"", m_coord(m_viewport->x), R""(, "y": )"", m_coord(m_viewport->y),
+                     R""(, "w": )"", m_coord(m_viewport->width), R""(, "h": )"", m_coord(m_viewport->height), " },\n");
+        }
+        write_to(os, " \"clips\": [\n  ");
         for (auto it = t_page.cps.begin(); it != t_page.cps.end(); ++it)
         {
             if (it != t_page.cps.begin())
             {
-                fmt::format_to(std::back_inserter(os), ",\n  ");
+                write_to(os, ",\n  ");
             }
-            fmt::format_to(std::back_inserter(os), R""({{ "id": {}, "x": {:.2f}, "y": {:.2f}, "w": {:.2f}, "h": {:.2f} }})"",
-                           it->id, it->rect.x, it->rect.y, it->rect.width, it->rect.height);
+            write_to(os, R""({ "id": )"", it->id, R""(, "x": )"", m_coord(it->rect.x), R""(, "y": )"", m_coord(it->rect.y),
+                     R""(, "w": )"", m_coord(it->rect.width), R""(, "h": )"", m_coord(it->rect.height), " }");
         }
 
-        fmt::format_to(std::back_inserter(os), "\n ],\n \"draw_calls\": [\n  ");
-        for (auto it = t_page.dcs.begin(); it != t_page.dcs.end(); ++it)
+        write_to(os, "\n ],\n \"draw_calls\": [\n  ");
+        const VisibleDrawCalls visible(t_page, m_viewport);
+        const auto last_dc = m_viewport ? visible.end() : t_page.dcs.end();
+        if (m_viewport)
         {
-            if (it != t_page.dcs.begin())
+            first_dc = visible.begin();
+        }
+        bool first = true;
+        for (auto it = first_dc; it != last_dc; ++it)
+        {
+            if (m_cull.skip(t_page, *it))
             {
-                fmt::format_to(std::back_inserter(os), ",\n  ");
+                continue;
             }
-            fmt::format_to(std::back_inserter(os), "{{ ");
-            (*it)->render(this);
-            fmt::format_to(std::back_inserter(os), " }}");
+            if (!first)
+            {
+                write_to(os, ",\n  ");
+            }
+            first = false;
+            write_to(os, "{ ");
+            t_page.render(*it, this);
+            write_to(os, " }");
+            m_drain(os, false);
         }
-        fmt::format_to(std::back_inserter(os), "\n ]\n}}");
+        write_to(os, "\n ]\n}");
+        m_drain(os, true);
     }
 
     void RendererJSON::dc(const DrawCall &t_dc)
     {
-        fmt::format_to(std::back_inserter(os), "\"type\": \"unknown\"");
+        write_to(os, "\"type\": \"unknown\"");
     }
 
     void RendererJSON::rect(const Rect &t_rect)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "rect", "clip_id": {}, "x": {:.2f}, "y": {:.2f}, "w": {:.2f}, "h": {:.2f}, "line": {})"",
-                       t_rect.clip_id, t_rect.rect.x, t_rect.rect.y, t_rect.rect.width, t_rect.rect.height, json_lineinfo(t_rect.line));
+        write_to(os, R""("type": "rect", "clip_id": )"", t_rect.clip_id, R""(, "x": )"", m_coord(t_rect.rect.x), R""(, "y": )"",
+                 m_coord(t_rect.rect.y), R""(, "w": )"", m_coord(t_rect.rect.width), R""(, "h": )"", m_coord(t_rect.rect.height),
+                 R""(, "line": )"");
+        json_lineinfo(os, t_rect.line);
     }
 
     void RendererJSON::text(const Text &t_text)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "text", "clip_id": {}, "x": {:.2f}, "y": {:.2f}, "rot": {:.2f}, "hadj": {:.2f}, "col": "{}", "str": "{}", )""
-                           R""("weight": {}, "features": "{}", "font_family": "{}", "fontsize": {:.2f}, "italic": {}, "txtwidth_px": {:.2f})"",
-                       t_text.clip_id, t_text.pos.x, t_text.pos.y, t_text.rot, t_text.hadj, hexcol(t_text.col), t_text.str,
-                       t_text.text.weight, t_text.text.features, t_text.text.font_family, t_text.text.fontsize, t_text.text.italic, t_text.text.txtwidth_px);
+        write_to(os, R""("type": "text", "clip_id": )"", t_text.clip_id, R""(, "x": )"", m_coord(t_text.pos.x), R""(, "y": )"",
+                 m_coord(t_text.pos.y), R""(, "rot": )"", fixed2(t_text.rot), R""(, "hadj": )"", fixed2(t_text.hadj),
+                 R""(, "col": ")"", hex_color(t_text.col), R""(", "str": ")"", t_text.str, R""(", "weight": )"",
+                 t_text.text.weight, R""(, "features": ")"", t_text.text.features, R""(", "font_family": ")"",
+                 t_text.text.font_family, R""(", "fontsize": )"", m_coord(t_text.text.fontsize), R""(, "italic": )"",
+                 t_text.text.italic, R""(, "txtwidth_px": )"", m_coord(t_text.txtwidth_px));
     }
 
     void RendererJSON::circle(const Circle &t_circle)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "circle", "clip_id": {}, "x": {:.2f}, "y": {:.2f}, "r": {:.2f}, "fill": "{}", "line": {})"",
-                       t_circle.clip_id, t_circle.pos.x, t_circle.pos.y, t_circle.radius, hexcol(t_circle.fill), json_lineinfo(t_circle.line));
+        write_to(os, R""("type": "circle", "clip_id": )"", t_circle.clip_id, R""(, "x": )"", m_coord(t_circle.pos.x),
+                 R""(, "y": )"", m_coord(t_circle.pos.y), R""(, "r": )"", m_coord(t_circle.radius), R""(, "fill": ")"",
+                 hex_color(t_circle.fill), R""(", "line": )"");
+        json_lineinfo(os, t_circle.line);
     }
 
     void RendererJSON::line(const Line &t_line)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "line", "clip_id": {}, "x0": {:.2f}, "y0": {:.2f}, "x1": {:.2f}, "y1": {:.2f}, "line": {})"",
-                       t_line.clip_id, t_line.orig.x, t_line.orig.y, t_line.dest.x, t_line.dest.y, json_lineinfo(t_line.line));
+        write_to(os, R""("type": "line", "clip_id": )"", t_line.clip_id, R""(, "x0": )"", m_coord(t_line.orig.x), R""(, "y0": )"",
+                 m_coord(t_line.orig.y), R""(, "x1": )"", m_coord(t_line.dest.x), R""(, "y1": )"", m_coord(t_line.dest.y),
+                 R""(, "line": )"");
+        json_lineinfo(os, t_line.line);
     }
 
     void RendererJSON::polyline(const Polyline &t_polyline)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "polyline", "clip_id": {}, "line": {}, "points": )"",
-                       t_polyline.clip_id, json_lineinfo(t_polyline.line));
-        json_verts(os, t_polyline.points);
+        write_to(os, R""("type": "polyline", "clip_id": )"", t_polyline.clip_id, R""(, "line": )"");
+        json_lineinfo(os, t_polyline.line);
+        write_to(os, R""(, "points": )"");
+        json_verts(os, m_simplify.points(t_polyline.points), m_coord);
     }
 
     void RendererJSON::polygon(const Polygon &t_polygon)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "polygon", "clip_id": {}, "fill": "{}", "line": {}, "points": )"",
-                       t_polygon.clip_id, hexcol(t_polygon.fill), json_lineinfo(t_polygon.line));
-        json_verts(os, t_polygon.points);
+        write_to(os, R""("type": "polygon", "clip_id": )"", t_polygon.clip_id, R""(, "fill": ")"", hex_color(t_polygon.fill),
+                 R""(", "line": )"");
+        json_lineinfo(os, t_polygon.line);
+        write_to(os, R""(, "points": )"");
+        json_verts(os, m_simplify.points(t_polygon.points), m_coord);
     }
 
     void RendererJSON::path(const Path &t_path)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "path", "clip_id": {}, "fill": "{}", "line": {}, "nper": )"",
-                       t_path.clip_id, hexcol(t_path.fill), json_lineinfo(t_path.line));
-
-        fmt::format_to(std::back_inserter(os), "[");
-        for (auto it = t_path.nper.begin(); it != t_path.nper.end(); ++it)
+        write_to(os, R""("type": "path", "clip_id": )"", t_path.clip_id, R""(, "fill": ")"", hex_color(t_path.fill), R""(", "line": )"");
+        json_lineinfo(os, t_path.line);
+        write_to(os, R""(, "nper": )"");
+
+        auto nper = t_path.nper;
+        const auto points = m_simplify.path(t_path.points, nper);
+        write_to(os, "[");
+        for (auto it = nper.begin(); it != nper.end(); ++it)
         {
-            if (it != t_path.nper.begin())
+            if (it != nper.begin())
             {
-                fmt::format_to(std::back_inserter(os), ", ");
+                write_to(os, ", ");
             }
-            fmt::format_to(std::back_inserter(os), "{}", *it);
+            write_to(os, *it);
         }
-        fmt::format_to(std::back_inserter(os), R""(], "points": )"");
-        json_verts(os, t_path.points);
+        write_to(os, R""(], "points": )"");
+        json_verts(os, points, m_coord);
     }
 
     void RendererJSON::raster(const Raster &t_raster)
     {
-        fmt::format_to(std::back_inserter(os), R""("type": "raster", "clip_id": {}, "x": {:.2f}, "y": {:.2f}, "w": {:.2f}, "h": {:.2f}, "rot": {:.2f}, "raster": {{ "w": {}, "h": {}, "data": "{}" }})"",
-                       t_raster.clip_id, t_raster.rect.x, t_raster.rect.y, t_raster.rect.width, t_raster.rect.height, t_raster.rot, t_raster.wh.x, t_raster.wh.y, raster_base64(t_raster));
+        write_to(os, R""("type": "raster", "clip_id": )"", t_raster.clip_id, R""(, "x": )"", m_coord(t_raster.rect.x),
+                 R""(, "y": )"", m_coord(t_raster.rect.y), R""(, "w": )"", m_coord(t_raster.rect.width), R""(, "h": )"",
+                 m_coord(t_raster.rect.height), R""(, "rot": )"", fixed2(t_raster.rot), R""(, "raster": { "w": )"", t_raster.wh.x,
+                 R""(, "h": )"", t_raster.wh.y, R""(, "data": ")"", *raster_base64(t_raster, m_fast_png), R""(" })"");
     }
 
 } // namespace httpgd::dc
@@ -1,17 +1,27 @@
 #ifndef RENDERER_JSON_H
 #define RENDERER_JSON_H
 
+#include "Cull.h"
 #include "DrawData.h"
+#include "Simplify.h"
+#include "TextWriter.h"
 #include <fmt/format.h>
+#include <boost/optional.hpp>
 
 namespace httpgd::dc
 {
     class RendererJSON : public StringRenderingTarget, public Renderer
     {
     public:
+        explicit RendererJSON(const RenderOptions &t_options = {});
+        // Only write the draw calls appended after sequence number t_since
+        // (if the page has not been cleared since).
+        explicit RendererJSON(std::uint64_t t_since);
+
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]]
         std::string get_string() const override;
+        std::string take_string() override;
 
         // Renderer
         void page(const Page &t_page) override;
@@ -28,6 +38,12 @@ namespace httpgd::dc
     private:
         fmt::memory_buffer os;
         double m_scale;
+        CoordFormat m_coord;
+        Simplifier m_simplify;
+        Culler m_cull;
+        boost::optional<grect<double>> m_viewport;
+        bool m_fast_png = false;
+        boost::optional<std::uint64_t> m_since;
     };
     
 } // namespace httpgd::dc
@@ -28,9 +28,19 @@ namespace httpgd
           ".svg",
           "SVG",
           "plot",
-          []() { return std::make_unique<dc::RendererSVG>(boost::none); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererSVG>(boost::none, false, t_options); },
           "Scalable Vector Graphics (SVG)."
         });
+
+        manager.add({
+          "svgc",
+          "image/svg+xml",
+          ".svg",
+          "Compact SVG",
+          "plot",
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererSVG>(boost::none, true, t_options); },
+          "Version of the SVG renderer that declares element styles as CSS classes, which produces smaller SVGs."
+        });
         
         manager.add(BinaryRendererInfo{
           "svgz",
@@ -38,7 +48,7 @@ namespace httpgd
           ".svgz",
           "SVGZ",
           "plot",
-          []() { return std::make_unique<dc::RendererSVGZ>(boost::none); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererSVGZ>(boost::none, t_options); },
           "Compressed Scalable Vector Graphics (SVGZ)."
         });
         
@@ -48,7 +58,7 @@ namespace httpgd
           ".svg",
           "Portable SVG",
           "plot",
-          []() { return std::make_unique<dc::RendererSVGPortable>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererSVGPortable>(t_options); },
           "Version of the SVG renderer that produces portable SVGs."
         });
         
@@ -58,7 +68,7 @@ namespace httpgd
           ".svgz",
           "Portable SVGZ",
           "plot",
-          []() { return std::make_unique<dc::RendererSVGZPortable>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererSVGZPortable>(t_options); },
           "Version of the SVG renderer that produces portable SVGZs."
         });
         
@@ -70,7 +80,7 @@ namespace httpgd
           ".png",
           "PNG",
           "plot",
-          []() { return std::make_unique<dc::RendererCairoPng>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererCairoPng>(t_options); },
           "Portable Network Graphics (PNG)."
         });
         
@@ -80,7 +90,7 @@ namespace httpgd
           ".pdf",
           "PDF",
           "plot",
-          []() { return std::make_unique<dc::RendererCairoPdf>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererCairoPdf>(t_options); },
           "Adobe Portable Document Format (PDF)."
         });
         
@@ -90,7 +100,7 @@ namespace httpgd
           ".ps",
           "PS",
           "plot",
-          []() { return std::make_unique<dc::RendererCairoPs>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererCairoPs>(t_options); },
           "PostScript (PS)."
         });
 
@@ -100,7 +110,7 @@ namespace httpgd
           ".eps",
           "EPS",
           "plot",
-          []() { return std::make_unique<dc::RendererCairoEps>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererCairoEps>(t_options); },
           "Encapsulated PostScript (EPS)."
         });
         
@@ -110,7 +120,7 @@ namespace httpgd
           ".tiff",
           "TIFF",
           "plot",
-          []() { return std::make_unique<dc::RendererCairoTiff>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererCairoTiff>(t_options); },
           "Tagged Image File Format (TIFF)."
         });
         
@@ -122,7 +132,7 @@ namespace httpgd
           ".json",
           "JSON",
           "plot",
-          []() { return std::make_unique<dc::RendererJSON>(); },
+          [](const dc::RenderOptions &t_options) { return std::make_unique<dc::RendererJSON>(t_options); },
           "Plot data serialized to JSON format."
         });
         
@@ -132,8 +142,9 @@ namespace httpgd
           ".tex",
           "TikZ",
           "plot",
-          []() { return std::make_unique<dc::RendererTikZ>(); },
-          "LaTeX TikZ code."
+          [](const dc::RenderOptions &) { return std::make_unique<dc::RendererTikZ>(); },
+          "LaTeX TikZ code.",
+          false
         });
         
         manager.add({
@@ -142,8 +153,9 @@ namespace httpgd
           ".txt",
           "Strings",
           "data",
-          []() { return std::make_unique<dc::RendererStrings>(); },
-          "List of strings contained in plot."
+          [](const dc::RenderOptions &) { return std::make_unique<dc::RendererStrings>(); },
+          "List of strings contained in plot.",
+          false
         });
         
         manager.add({
@@ -152,8 +164,9 @@ namespace httpgd
           ".json",
           "Meta",
           "data",
-          []() { return std::make_unique<dc::RendererMeta>(); },
-          "Plot meta information."
+          [](const dc::RenderOptions &) { return std::make_unique<dc::RendererMeta>(); },
+          "Plot meta information.",
+          false
         });
 
         return manager;
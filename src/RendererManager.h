@@ -19,8 +19,10 @@ namespace httpgd
         std::string fileext;
         std::string name;
         std::string type;
-        std::function<std::unique_ptr<T>()> renderer;
+        std::function<std::unique_ptr<T>(const dc::RenderOptions &)> renderer;
         std::string description;
+        // false if the output does not depend on dc::RenderOptions
+        bool uses_options = true;
     };
     
     using StringRendererInfo = RendererManagerInfo<dc::StringRenderingTarget>;
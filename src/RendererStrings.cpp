@@ -18,7 +18,7 @@ namespace httpgd::dc
         string_count = 0;
         for (auto it = t_page.dcs.begin(); it != t_page.dcs.end(); ++it)
         {
-            (*it)->render(this);
+            t_page.render(*it, this);
         }
     }
 
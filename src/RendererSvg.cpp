@@ -1,5 +1,6 @@
 #include "RendererSvg.h"
 
+#include <algorithm>
 #include <cmath>
 #include <fmt/ostream.h>
 #include <functional>
@@ -7,35 +8,184 @@
 #include "Base64.h"
 #include "HttpgdRng.h"
 #include "HttpgdCompress.h"
+#include "RendererCairo.h"
+#include "SpatialIndex.h"
+#include "TextWriter.h"
 
 namespace httpgd::dc
 {
-    
-    static inline void write_xml_escaped(fmt::memory_buffer &os, const std::string &text)
+    using DrawCallIterator = std::vector<DrawCall>::const_iterator;
+
+    // Shortest run of draw calls that is embedded as image
+    static constexpr std::ptrdiff_t raster_layer_min = 100;
+
+    /**
+     * Finds the dense layers in the draw calls of a page (see
+     * RenderOptions::raster_threshold):
+     * Runs of at least raster_layer_min non-text draw calls in the same
+     * clip region. Text, and with it axis labels and titles, always stays
+     * vector graphics.
+     */
+    class RasterLayers
+    {
+    public:
+        RasterLayers(const std::vector<DrawCall> &t_dcs, const RenderOptions &t_options)
+            : RasterLayers(t_dcs, t_options.raster_threshold > 0 && t_dcs.size() > t_options.raster_threshold)
+        {
+        }
+
+        RasterLayers(const std::vector<DrawCall> &t_dcs, bool t_enabled)
+            : m_end(t_dcs.end()), m_checked(t_dcs.begin())
+        {
+#ifndef HTTPGD_NO_CAIRO
+            m_enabled = t_enabled;
+#endif
+        }
+
+        // End of the layer starting at t_it, t_it if there is none.
+        // Needs to be called with increasing t_it.
+        DrawCallIterator layer_end(DrawCallIterator t_it)
+        {
+            if (!m_enabled || t_it < m_checked)
+            {
+                return t_it;
+            }
+            auto it = t_it;
+            while (it != m_end && it->type != DrawCallType::TEXT && it->clip_id == t_it->clip_id)
+            {
+                ++it;
+            }
+            m_checked = std::max(it, t_it + 1);
+            return (it - t_it >= raster_layer_min) ? it : t_it;
+        }
+
+    private:
+        bool m_enabled = false;
+        DrawCallIterator m_end;
+        DrawCallIterator m_checked; // no layer starts before this
+    };
+
+    static inline void hash_combine(std::uint64_t &t_hash, std::uint64_t t_value)
+    {
+        t_hash ^= t_value + 0x9e3779b9 + (t_hash << 6) + (t_hash >> 2);
+    }
+
+    // Identifies the layer [t_first, t_last) of the visible draw calls
+    // t_dcs and everything its image depends on.
+    static std::uint64_t raster_layer_hash(const Page &t_page, const std::vector<DrawCall> &t_dcs, DrawCallIterator t_first, DrawCallIterator t_last,
+                                           double t_scale, const RenderOptions &t_options)
+    {
+        std::uint64_t h = t_page.version;
+        hash_combine(h, std::hash<double>{}(t_page.size.x));
+        hash_combine(h, std::hash<double>{}(t_page.size.y));
+        hash_combine(h, t_first - t_dcs.begin());
+        hash_combine(h, t_last - t_dcs.begin());
+        hash_combine(h, std::hash<double>{}(t_scale));
+        hash_combine(h, t_options.cull);
+        if (t_options.viewport)
+        {
+            hash_combine(h, std::hash<double>{}(t_options.viewport->x));
+            hash_combine(h, std::hash<double>{}(t_options.viewport->y));
+            hash_combine(h, std::hash<double>{}(t_options.viewport->width));
+            hash_combine(h, std::hash<double>{}(t_options.viewport->height));
+        }
+        return h;
+    }
+
+#ifndef HTTPGD_NO_CAIRO
+    static inline const Clip &layer_clip(const Page &t_page, DrawCallIterator t_first)
+    {
+        return *std::find_if(t_page.cps.begin(), t_page.cps.end(), [&](const Clip &c) {
+            return c.id == t_first->clip_id;
+        });
+    }
+
+    static inline std::vector<unsigned char> render_raster_layer(const Page &t_page, DrawCallIterator t_first, DrawCallIterator t_last,
+                                                                 double t_scale, const RenderOptions &t_options)
     {
-        for (const char &c : text)
+        return RendererCairoLayer(t_options).render(t_page, t_first, t_last, layer_clip(t_page, t_first).rect, t_scale);
+    }
+#endif
+
+    std::vector<unsigned char> raster_layer_png(const Page &t_page, std::uint64_t t_hash, double t_scale, const RenderOptions &t_options)
+    {
+#ifndef HTTPGD_NO_CAIRO
+        const VisibleDrawCalls dcs(t_page, t_options.viewport);
+        RasterLayers layers(dcs.get(), true);
+        for (auto it = dcs.begin(); it != dcs.end(); ++it)
         {
+            const auto layer_end = layers.layer_end(it);
+            if (layer_end != it && raster_layer_hash(t_page, dcs.get(), it, layer_end, t_scale, t_options) == t_hash)
+            {
+                return render_raster_layer(t_page, it, layer_end, t_scale, t_options);
+            }
+        }
+#endif
+        return {};
+    }
+
+    static inline void write_xml_escaped(fmt::memory_buffer &os, const std::string &text)
+    {
+        write_escaped(os, text, [](char c) -> const char * {
             switch (c)
             {
             case '&':
-                fmt::format_to(std::back_inserter(os), "&amp;");
-                break;
+                return "&amp;";
             case '<':
-                fmt::format_to(std::back_inserter(os), "&lt;");
-                break;
+                return "&lt;";
             case '>':
-                fmt::format_to(std::back_inserter(os), "&gt;");
-                break;
+                return "&gt;";
             case '"':
-                fmt::format_to(std::back_inserter(os), "&quot;");
-                break;
+                return "&quot;";
             case '\'':
-                fmt::format_to(std::back_inserter(os), "&apos;");
-                break;
+                return "&apos;";
             default:
-                fmt::format_to(std::back_inserter(os), "{}", c);
+                return nullptr;
             }
+        });
+    }
+
+    // Writes the start of the href attribute of a raster image: the PNG as
+    // data URI, or a link to it with the query t_url_query
+    // (RenderOptions::raster_url).
+    static inline void write_raster_href(fmt::memory_buffer &os, const std::string &t_url_query, const RenderOptions &t_options,
+                                         const std::function<std::shared_ptr<const std::string>()> &t_base64)
+    {
+        if (t_options.raster_url.empty())
+        {
+            write_to(os, " xlink:href=\"data:image/png;base64,", *t_base64());
+            return;
         }
+        write_to(os, " xlink:href=\"");
+        write_xml_escaped(os, t_options.raster_url + t_url_query);
+    }
+
+    static inline void write_raster_layer(fmt::memory_buffer &os, const Page &t_page, const std::vector<DrawCall> &t_dcs, DrawCallIterator t_first,
+                                          DrawCallIterator t_last, double t_scale, const RenderOptions &t_options, const CoordFormat &t_coord)
+    {
+#ifndef HTTPGD_NO_CAIRO
+        const auto &clip = layer_clip(t_page, t_first);
+        write_to(os, R""(<image x=")"", t_coord(clip.rect.x), R""(" y=")"", t_coord(clip.rect.y), R""(" width=")"",
+                 t_coord(clip.rect.width), R""(" height=")"", t_coord(clip.rect.height), R""(" preserveAspectRatio="none")"");
+        // Served by the /raster endpoint, which finds the layer again by
+        // its hash (see raster_layer_png()).
+        auto query = fmt::format("id={}&hash={:016x}&scale={}", t_page.id,
+                                 raster_layer_hash(t_page, t_dcs, t_first, t_last, t_scale, t_options), t_scale);
+        if (t_options.cull)
+        {
+            query += "&cull=true";
+        }
+        if (t_options.viewport)
+        {
+            query += fmt::format("&viewport={},{},{},{}", t_options.viewport->x, t_options.viewport->y,
+                                 t_options.viewport->width, t_options.viewport->height);
+        }
+        write_raster_href(os, query, t_options, [&] {
+            const auto png = render_raster_layer(t_page, t_first, t_last, t_scale, t_options);
+            return std::make_shared<const std::string>(base64_encode(png.data(), png.size()));
+        });
+        write_to(os, "\"/>");
+#endif
     }
 
     static inline void css_fill_or_none(fmt::memory_buffer &os, color_t col)
@@ -43,14 +193,14 @@ namespace httpgd::dc
         int alpha = color::alpha(col);
         if (alpha == 0)
         {
-            fmt::format_to(std::back_inserter(os), "fill: none;");
+            write_to(os, "fill: none;");
         }
         else
         {
-            fmt::format_to(std::back_inserter(os), "fill: #{:02X}{:02X}{:02X};", color::red(col), color::green(col), color::blue(col));
+            write_to(os, "fill: ", hex_color(col), ";");
             if (alpha != 255)
             {
-                fmt::format_to(std::back_inserter(os), "fill-opacity: {:.2f};", alpha / 255.0);
+                write_to(os, "fill-opacity: ", fixed2(alpha / 255.0), ";");
             }
         }
     }
@@ -60,10 +210,10 @@ namespace httpgd::dc
         int alpha = color::alpha(col);
         if (alpha != 0)
         {
-            fmt::format_to(std::back_inserter(os), "fill: #{:02X}{:02X}{:02X};", color::red(col), color::green(col), color::blue(col));
+            write_to(os, "fill: ", hex_color(col), ";");
             if (alpha != 255)
             {
-                fmt::format_to(std::back_inserter(os), "fill-opacity: {:.2f};", alpha / 255.0);
+                write_to(os, "fill-opacity: ", fixed2(alpha / 255.0), ";");
             }
         }
     }
@@ -74,11 +224,11 @@ namespace httpgd::dc
         // https://github.com/wch/r-source/blob/master/src/library/grDevices/src/cairo/cairoFns.c#L134
         return ((lwd > 1) ? lwd : 1) * (lty & 15);
     }
-    static inline void css_lineinfo(fmt::memory_buffer &os, const LineInfo &line)
+    static inline void css_lineinfo(fmt::memory_buffer &os, const LineInfo &line, const CoordFormat &coord)
     {
 
         // 1 lwd = 1/96", but units in rest of document are 1/72"
-        fmt::format_to(std::back_inserter(os), "stroke-width: {:.2f};", line.lwd / 96.0 * 72);
+        write_to(os, "stroke-width: ", coord(line.lwd / 96.0 * 72), ";");
 
         // Default is "stroke: #000000;" as declared in <style>
         if (line.col != color::rgba(0, 0, 0, 255))
@@ -86,14 +236,14 @@ namespace httpgd::dc
             int alpha = color::alpha(line.col);
             if (alpha == 0)
             {
-                fmt::format_to(std::back_inserter(os), "stroke: none;");
+                write_to(os, "stroke: none;");
             }
             else
             {
-                fmt::format_to(std::back_inserter(os), "stroke: #{:02X}{:02X}{:02X};", color::red(line.col), color::green(line.col), color::blue(line.col));
+                write_to(os, "stroke: ", hex_color(line.col), ";");
                 if (alpha != color::byte_mask)
                 {
-                    fmt::format_to(std::back_inserter(os), "stroke-opacity: {:.2f};", color::byte_frac(alpha));
+                    write_to(os, "stroke-opacity: ", fixed2(color::byte_frac(alpha)), ";");
                 }
             }
         }
@@ -108,17 +258,17 @@ namespace httpgd::dc
         default:
             // For details
             // https://github.com/wch/r-source/blob/trunk/src/include/R_ext/GraphicsEngine.h#L337
-            fmt::format_to(std::back_inserter(os), " stroke-dasharray: ");
+            write_to(os, " stroke-dasharray: ");
             // First number
-            fmt::format_to(std::back_inserter(os), "{:.2f}", scale_lty(lty, line.lwd));
+            write_to(os, coord(scale_lty(lty, line.lwd)));
             lty = lty >> 4;
             // Remaining numbers
             for (int i = 1; i < 8 && lty & 15; i++)
             {
-                fmt::format_to(std::back_inserter(os), ", {:.2f}", scale_lty(lty, line.lwd));
+                write_to(os, ", ", coord(scale_lty(lty, line.lwd)));
                 lty = lty >> 4;
             }
-            fmt::format_to(std::back_inserter(os), ";");
+            write_to(os, ";");
             break;
         }
 
@@ -128,10 +278,10 @@ namespace httpgd::dc
         case LineInfo::GC_ROUND_CAP: // declared to be default in <style>
             break;
         case LineInfo::GC_BUTT_CAP:
-            fmt::format_to(std::back_inserter(os), "stroke-linecap: butt;");
+            write_to(os, "stroke-linecap: butt;");
             break;
         case LineInfo::GC_SQUARE_CAP:
-            fmt::format_to(std::back_inserter(os), "stroke-linecap: square;");
+            write_to(os, "stroke-linecap: square;");
             break;
         default:
             break;
@@ -143,13 +293,13 @@ namespace httpgd::dc
         case LineInfo::GC_ROUND_JOIN: // declared to be default in <style>
             break;
         case LineInfo::GC_BEVEL_JOIN:
-            fmt::format_to(std::back_inserter(os), "stroke-linejoin: bevel;");
+            write_to(os, "stroke-linejoin: bevel;");
             break;
         case LineInfo::GC_MITRE_JOIN:
-            fmt::format_to(std::back_inserter(os), "stroke-linejoin: miter;");
+            write_to(os, "stroke-linejoin: miter;");
             if (std::fabs(line.lmitre - 10.0) > 1e-3)
             { // 10 is declared to be the default in <style>
-                fmt::format_to(std::back_inserter(os), "stroke-miterlimit: {:.2f};", line.lmitre);
+                write_to(os, "stroke-miterlimit: ", fixed2(line.lmitre), ";");
             }
             break;
         default:
@@ -157,14 +307,42 @@ namespace httpgd::dc
         }
     }
 
-    RendererSVG::RendererSVG(boost::optional<std::string> t_extra_css)
-        : os(), m_extra_css(t_extra_css)
+    static inline void css_font(fmt::memory_buffer &os, const TextInfo &text, const CoordFormat &coord)
+    {
+        write_to(os, "font-family: ", text.font_family, ";font-size: ", coord(text.fontsize), "px;");
+
+        if (text.weight != 400)
+        {
+            if (text.weight == 700)
+            {
+                write_to(os, "font-weight: bold;");
+            }
+            else
+            {
+                write_to(os, "font-weight: ", text.weight, ";");
+            }
+        }
+        if (text.italic)
+        {
+            write_to(os, "font-style: italic;");
+        }
+    }
+
+    RendererSVG::RendererSVG(boost::optional<std::string> t_extra_css, bool t_css_classes, const RenderOptions &t_options)
+        : os(), m_extra_css(t_extra_css), m_options(t_options), m_coord(t_options), m_simplify(t_options.simplify),
+          m_cull(t_options.cull), m_css_classes(t_css_classes)
     {
     }
     
     void RendererSVG::render(const Page &t_page, double t_scale) 
     {
+        if (m_css_classes)
+        {
+            m_unique_id = fmt::format("{}-{}", t_page.id, t_page.version);
+        }
         m_scale = t_scale;
+        m_simplify.set_scale(t_scale);
+        m_cull.begin(t_page, t_scale);
         this->page(t_page);
     }
     
@@ -172,61 +350,209 @@ namespace httpgd::dc
     {
         return fmt::to_string(os);
     }
+
+    std::string RendererSVG::take_string()
+    {
+        auto out = fmt::to_string(os);
+        os = fmt::memory_buffer(); // release the buffer right away
+        return out;
+    }
     
     void RendererSVG::page(const Page &t_page) 
     {
-        os.reserve((t_page.dcs.size() + t_page.cps.size()) * 128 + 512);
-        fmt::format_to(std::back_inserter(os), R""(<svg xmlns="http://www.w3.org/2000/svg" xmlns:xlink="http://www.w3.org/1999/xlink" class="httpgd" )"");
-        fmt::format_to(std::back_inserter(os),
-                   R""(width="{:.2f}" height="{:.2f}" viewBox="0 0 {:.2f} {:.2f}")"",
-                   t_page.size.x * m_scale, t_page.size.y * m_scale, t_page.size.x, t_page.size.y);
-        fmt::format_to(std::back_inserter(os), ">\n<defs>\n"
-              "  <style type='text/css'><![CDATA[\n"
-              "    .httpgd line, .httpgd polyline, .httpgd polygon, .httpgd path, .httpgd rect, .httpgd circle {{\n"
-              "      fill: none;\n"
-              "      stroke: #000000;\n"
-              "      stroke-linecap: round;\n"
-              "      stroke-linejoin: round;\n"
-              "      stroke-miterlimit: 10.00;\n"
-              "    }}\n");
+        m_page_id = t_page.id;
+        if (m_chunk_size == 0 && !m_options.viewport)
+        {
+            os.reserve((t_page.dcs.size() + t_page.cps.size()) * 128 + 512);
+        }
+        if (!m_css_classes)
+        {
+            m_page_head(t_page);
+            m_page_body(t_page);
+            m_drain(os, true);
+            return;
+        }
+
+        // The fill classes are only known after rendering the draw calls
+        m_page_body(t_page);
+        fmt::memory_buffer body = std::move(os);
+        os.clear();
+        os.reserve(body.size() + (t_page.cps.size() + t_page.line_styles().size() + t_page.text_styles().size() + m_fills.size()) * 128 + 512);
+        m_page_head(t_page);
+        os.append(body.data(), body.data() + body.size());
+    }
+
+    void RendererSVG::m_page_head(const Page &t_page)
+    {
+        write_to(os, R""(<svg xmlns="http://www.w3.org/2000/svg" xmlns:xlink="http://www.w3.org/1999/xlink" class="httpgd" )"");
+        if (m_css_classes)
+        {
+            write_to(os, R""(id="plot-)"", m_unique_id, R""(" )"");
+        }
+        const auto area = render_area(t_page, m_options.viewport);
+        write_to(os, R""(width=")"", fixed2(area.width * m_scale), R""(" height=")"", fixed2(area.height * m_scale), R""(" viewBox=")"");
+        if (m_options.viewport)
+        {
+            write_to(os, m_coord(area.x), " ", m_coord(area.y), " ");
+        }
+        else
+        {
+            write_to(os, "0 0 ");
+        }
+        write_to(os, m_coord(area.width), " ", m_coord(area.height), "\"");
+        if (!m_css_classes)
+        {
+            write_str(os, ">\n<defs>\n"
+                  "  <style type='text/css'><![CDATA[\n"
+                  "    .httpgd line, .httpgd polyline, .httpgd polygon, .httpgd path, .httpgd rect, .httpgd circle {\n"
+                  "      fill: none;\n"
+                  "      stroke: #000000;\n"
+                  "      stroke-linecap: round;\n"
+                  "      stroke-linejoin: round;\n"
+                  "      stroke-miterlimit: 10.00;\n"
+                  "    }\n");
+        }
+        else
+        {
+            const std::string scope = "#plot-" + m_unique_id;
+            write_to(os, ">\n<defs>\n"
+                     "  <style type='text/css'><![CDATA[\n    ",
+                     scope, " line, ", scope, " polyline, ", scope, " polygon, ", scope, " path, ", scope, " rect, ", scope, " circle {\n"
+                     "      fill: none;\n"
+                     "      stroke: #000000;\n"
+                     "      stroke-linecap: round;\n"
+                     "      stroke-linejoin: round;\n"
+                     "      stroke-miterlimit: 10.00;\n"
+                     "    }\n");
+            const auto &line_styles = t_page.line_styles();
+            for (std::size_t i = 0; i < line_styles.size(); ++i)
+            {
+                write_to(os, "    ", scope, " .l", i, " { ");
+                css_lineinfo(os, line_styles[i], m_coord);
+                write_to(os, " }\n");
+            }
+            const auto &text_styles = t_page.text_styles();
+            for (std::size_t i = 0; i < text_styles.size(); ++i)
+            {
+                write_to(os, "    ", scope, " .t", i, " { ");
+                css_font(os, text_styles[i], m_coord);
+                if (text_styles[i].features.length() > 0)
+                {
+                    write_to(os, "font-feature-settings: ", text_styles[i].features, ";");
+                }
+                write_to(os, " }\n");
+            }
+            for (std::size_t i = 0; i < m_fills.size(); ++i)
+            {
+                write_to(os, "    ", scope, " .f", i, " { ");
+                css_fill_or_none(os, m_fills[i]);
+                write_to(os, " }\n");
+            }
+        }
         if (m_extra_css)
         {
-            fmt::format_to(std::back_inserter(os), "{}\n", *m_extra_css);
+            write_to(os, *m_extra_css, "\n");
         }
-        fmt::format_to(std::back_inserter(os), 
-              "  ]]></style>\n");
+        write_to(os, "  ]]></style>\n");
 
         for (const auto &cp : t_page.cps)
         {
-            fmt::format_to(std::back_inserter(os), R""(<clipPath id="c{:d}"><rect x="{:.2f}" y="{:.2f}" width="{:.2f}" height="{:.2f}"/></clipPath>)"" "\n",
-                    cp.id,
-                    cp.rect.x,
-                    cp.rect.y,
-                    cp.rect.width,
-                    cp.rect.height);
+            write_to(os, R""(<clipPath id="c)"", cp.id, R""("><rect x=")"", m_coord(cp.rect.x), R""(" y=")"", m_coord(cp.rect.y),
+                     R""(" width=")"", m_coord(cp.rect.width), R""(" height=")"", m_coord(cp.rect.height), "\"/></clipPath>\n");
+        }
+        write_to(os, "</defs>\n");
+    }
+
+    void RendererSVG::m_page_body(const Page &t_page)
+    {
+        write_to(os, "<rect ");
+        if (m_options.viewport)
+        {
+            write_to(os, R""(x=")"", m_coord(m_options.viewport->x), R""(" y=")"", m_coord(m_options.viewport->y), "\" ");
         }
-        fmt::format_to(std::back_inserter(os), "</defs>\n");
-        fmt::format_to(std::back_inserter(os), R""(<rect width="100%" height="100%" style="stroke: none;fill: #{:02X}{:02X}{:02X};"/>)"" "\n",
-                   color::red(t_page.fill), color::green(t_page.fill), color::blue(t_page.fill));
+        write_to(os, R""(width="100%" height="100%" style="stroke: none;fill: )"", hex_color(t_page.fill), ";\"/>\n");
 
         clip_id_t last_id = t_page.cps.front().id;
-        fmt::format_to(std::back_inserter(os), R""(<g clip-path="url(#c{:d})">)"" "\n", last_id);
-        for (const auto &dc : t_page.dcs)
+        write_to(os, R""(<g clip-path="url(#c)"", last_id, ")\">\n");
+        const VisibleDrawCalls dcs(t_page, m_options.viewport);
+        RasterLayers layers(dcs.get(), m_options);
+        for (auto it = dcs.begin(); it != dcs.end();)
         {
-            if (dc->clip_id != last_id)
+            const auto layer_end = layers.layer_end(it);
+            if (layer_end == it && m_cull.skip(t_page, *it))
+            {
+                ++it;
+                continue;
+            }
+            if (it->clip_id != last_id)
+            {
+                write_to(os, R""(</g><g clip-path="url(#c)"", it->clip_id, ")\">\n");
+                last_id = it->clip_id;
+            }
+            if (layer_end != it)
+            {
+                write_raster_layer(os, t_page, dcs.get(), it, layer_end, m_scale, m_options, m_coord);
+                it = layer_end;
+            }
+            else
+            {
+                t_page.render(*it, this);
+                ++it;
+            }
+            write_to(os, "\n");
+            if (!m_css_classes)
             {
-                fmt::format_to(std::back_inserter(os), R""(</g><g clip-path="url(#c{:d})">)"" "\n", dc->clip_id);
-                last_id = dc->clip_id;
+                m_drain(os, false);
             }
-            dc->render(this);
-            fmt::format_to(std::back_inserter(os), "\n");
         }
-        fmt::format_to(std::back_inserter(os), "</g>\n</svg>");
+        write_to(os, "</g>\n</svg>");
+    }
+
+    std::size_t RendererSVG::m_fill_class(color_t t_fill)
+    {
+        const auto it = m_fill_classes.find(t_fill);
+        if (it != m_fill_classes.end())
+        {
+            return it->second;
+        }
+        m_fills.push_back(t_fill);
+        m_fill_classes.emplace(t_fill, m_fills.size() - 1);
+        return m_fills.size() - 1;
+    }
+
+    void RendererSVG::m_style(const LineInfo &t_line, style_id_t t_line_id)
+    {
+        if (m_css_classes)
+        {
+            write_to(os, "class=\"l", t_line_id, "\"");
+            return;
+        }
+        write_to(os, "style=\"");
+        css_lineinfo(os, t_line, m_coord);
+        write_to(os, "\"");
+    }
+
+    void RendererSVG::m_style(const LineInfo &t_line, style_id_t t_line_id, color_t t_fill)
+    {
+        if (m_css_classes)
+        {
+            write_to(os, "class=\"l", t_line_id);
+            if (!color::transparent(t_fill))
+            {
+                write_to(os, " f", m_fill_class(t_fill));
+            }
+            write_to(os, "\"");
+            return;
+        }
+        write_to(os, "style=\"");
+        css_lineinfo(os, t_line, m_coord);
+        css_fill_or_omit(os, t_fill);
+        write_to(os, "\"");
     }
 
     void RendererSVG::dc(const DrawCall &)
     {
-        fmt::format_to(std::back_inserter(os), "<!-- unknown draw call -->");
+        write_to(os, "<!-- unknown draw call -->");
     }
 
     void RendererSVG::text(const Text &t_text)
@@ -234,193 +560,196 @@ namespace httpgd::dc
         // If we specify the clip path inside <image>, the "transform" also
         // affects the clip path, so we need to specify clip path at an outer level
         // (according to svglite)
-        fmt::format_to(std::back_inserter(os), "<g><text ");
+        write_to(os, "<g><text ");
 
         if (t_text.rot == 0.0)
         {
-            fmt::format_to(std::back_inserter(os), R""(x="{:.2f}" y="{:.2f}" )"", t_text.pos.x, t_text.pos.y);
+            write_to(os, R""(x=")"", m_coord(t_text.pos.x), R""(" y=")"", m_coord(t_text.pos.y), R""(" )"");
         }
         else
         {
-            fmt::format_to(std::back_inserter(os), R""(transform="translate({:.2f},{:.2f}) rotate({:.2f})" )"", t_text.pos.x, t_text.pos.y, t_text.rot * -1.0);
+            write_to(os, R""(transform="translate()"", m_coord(t_text.pos.x), ",", m_coord(t_text.pos.y), ") rotate(",
+                     fixed2(t_text.rot * -1.0), R""()" )"");
         }
 
         if (t_text.hadj == 0.5)
         {
-            fmt::format_to(std::back_inserter(os), R""(text-anchor="middle" )"");
+            write_to(os, R""(text-anchor="middle" )"");
         }
         else if (t_text.hadj == 1)
         {
-            fmt::format_to(std::back_inserter(os), R""(text-anchor="end" )"");
+            write_to(os, R""(text-anchor="end" )"");
         }
 
-        fmt::format_to(std::back_inserter(os), "style=\"");
-        fmt::format_to(std::back_inserter(os), "font-family: {};font-size: {:.2f}px;", t_text.text.font_family, t_text.text.fontsize);
-
-        if (t_text.text.weight != 400)
+        if (m_css_classes)
         {
-            if (t_text.text.weight == 700)
+            write_to(os, "class=\"t", t_text.text_id);
+            if (t_text.col != (int)color::rgb(0, 0, 0))
             {
-                fmt::format_to(std::back_inserter(os), "font-weight: bold;");
+                write_to(os, " f", m_fill_class(t_text.col));
             }
-            else
-            {
-                fmt::format_to(std::back_inserter(os), "font-weight: {};", t_text.text.weight);
-            }
-        }
-        if (t_text.text.italic)
-        {
-            fmt::format_to(std::back_inserter(os), "font-style: italic;");
+            write_to(os, "\"");
         }
-        if (t_text.col != (int)color::rgb(0, 0, 0))
-        {
-            css_fill_or_none(os, t_text.col);
-        }
-        if (t_text.text.features.length() > 0)
+        else
         {
-            fmt::format_to(std::back_inserter(os), "font-feature-settings: {};", t_text.text.features);
+            write_to(os, "style=\"");
+            css_font(os, t_text.text, m_coord);
+            if (t_text.col != (int)color::rgb(0, 0, 0))
+            {
+                css_fill_or_none(os, t_text.col);
+            }
+            if (t_text.text.features.length() > 0)
+            {
+                write_to(os, "font-feature-settings: ", t_text.text.features, ";");
+            }
+            write_to(os, "\"");
         }
-        fmt::format_to(std::back_inserter(os), "\"");
-        if (t_text.text.txtwidth_px > 0)
+        if (t_text.txtwidth_px > 0)
         {
-            fmt::format_to(std::back_inserter(os), R""( textLength="{:.2f}px" lengthAdjust="spacingAndGlyphs")"", t_text.text.txtwidth_px);
+            write_to(os, R""( textLength=")"", m_coord(t_text.txtwidth_px), R""(px" lengthAdjust="spacingAndGlyphs")"");
         }
-        fmt::format_to(std::back_inserter(os), ">");
+        write_to(os, ">");
         write_xml_escaped(os, t_text.str);
-        fmt::format_to(std::back_inserter(os), "</text></g>");
+        write_to(os, "</text></g>");
     }
 
     void RendererSVG::circle(const Circle &t_circle)
     {
-        fmt::format_to(std::back_inserter(os), "<circle ");
-        fmt::format_to(std::back_inserter(os), R""(cx="{:.2f}" cy="{:.2f}" r="{:.2f}" )"", t_circle.pos.x, t_circle.pos.y, t_circle.radius);
+        write_to(os, "<circle ");
+        write_to(os, R""(cx=")"", m_coord(t_circle.pos.x), R""(" cy=")"", m_coord(t_circle.pos.y), R""(" r=")"",
+                 m_coord(t_circle.radius), R""(" )"");
 
-        fmt::format_to(std::back_inserter(os), "style=\"");
-        css_lineinfo(os, t_circle.line);
-        css_fill_or_omit(os, t_circle.fill);
-        fmt::format_to(std::back_inserter(os), "\"/>");
+        m_style(t_circle.line, t_circle.line_id, t_circle.fill);
+        write_to(os, "/>");
     }
 
     void RendererSVG::line(const Line &t_line)
     {
-        fmt::format_to(std::back_inserter(os), "<line ");
-        fmt::format_to(std::back_inserter(os), R""(x1="{:.2f}" y1="{:.2f}" x2="{:.2f}" y2="{:.2f}" )"", t_line.orig.x, t_line.orig.y, t_line.dest.x, t_line.dest.y);
+        write_to(os, "<line ");
+        write_to(os, R""(x1=")"", m_coord(t_line.orig.x), R""(" y1=")"", m_coord(t_line.orig.y), R""(" x2=")"",
+                 m_coord(t_line.dest.x), R""(" y2=")"", m_coord(t_line.dest.y), R""(" )"");
 
-        fmt::format_to(std::back_inserter(os), "style=\"");
-        css_lineinfo(os, t_line.line);
-        fmt::format_to(std::back_inserter(os), "\"/>");
+        m_style(t_line.line, t_line.line_id);
+        write_to(os, "/>");
     }
 
     void RendererSVG::rect(const Rect &t_rect)
     {
-        fmt::format_to(std::back_inserter(os), "<rect ");
-        fmt::format_to(std::back_inserter(os), R""(x="{:.2f}" y="{:.2f}" width="{:.2f}" height="{:.2f}" )"",
-                   t_rect.rect.x,
-                   t_rect.rect.y,
-                   t_rect.rect.width,
-                   t_rect.rect.height);
+        write_to(os, "<rect ");
+        write_to(os, R""(x=")"", m_coord(t_rect.rect.x), R""(" y=")"", m_coord(t_rect.rect.y), R""(" width=")"",
+                 m_coord(t_rect.rect.width), R""(" height=")"", m_coord(t_rect.rect.height), R""(" )"");
 
-        fmt::format_to(std::back_inserter(os), "style=\"");
-        css_lineinfo(os, t_rect.line);
-        css_fill_or_omit(os, t_rect.fill);
-        fmt::format_to(std::back_inserter(os), "\"/>");
+        m_style(t_rect.line, t_rect.line_id, t_rect.fill);
+        write_to(os, "/>");
     }
 
     void RendererSVG::polyline(const Polyline &t_polyline)
     {
-        fmt::format_to(std::back_inserter(os), "<polyline points=\"");
-        for (auto it = t_polyline.points.begin(); it != t_polyline.points.end(); ++it)
+        const auto points = m_simplify.points(t_polyline.points);
+        write_to(os, "<polyline points=\"");
+        for (auto it = points.begin(); it != points.end(); ++it)
         {
-            if (it != t_polyline.points.begin())
+            if (it != points.begin())
             {
-                fmt::format_to(std::back_inserter(os), " ");
+                write_to(os, " ");
             }
-            fmt::format_to(std::back_inserter(os), "{:.2f},{:.2f}", it->x, it->y);
+            write_to(os, m_coord(it->x), ",", m_coord(it->y));
         }
-        fmt::format_to(std::back_inserter(os), "\" style=\"");
-        css_lineinfo(os, t_polyline.line);
-        fmt::format_to(std::back_inserter(os), "\"/>");
+        write_to(os, "\" ");
+        m_style(t_polyline.line, t_polyline.line_id);
+        write_to(os, "/>");
     }
 
     void RendererSVG::polygon(const Polygon &t_polygon)
     {
-        fmt::format_to(std::back_inserter(os), "<polygon points=\"");
-        for (auto it = t_polygon.points.begin(); it != t_polygon.points.end(); ++it)
+        const auto points = m_simplify.points(t_polygon.points);
+        write_to(os, "<polygon points=\"");
+        for (auto it = points.begin(); it != points.end(); ++it)
         {
-            if (it != t_polygon.points.begin())
+            if (it != points.begin())
             {
-                fmt::format_to(std::back_inserter(os), " ");
+                write_to(os, " ");
             }
-            fmt::format_to(std::back_inserter(os), "{:.2f},{:.2f}", it->x, it->y);
+            write_to(os, m_coord(it->x), ",", m_coord(it->y));
         }
-        fmt::format_to(std::back_inserter(os), "\" ");
+        write_to(os, "\" ");
 
-        fmt::format_to(std::back_inserter(os), "style=\"");
-        css_lineinfo(os, t_polygon.line);
-        css_fill_or_omit(os, t_polygon.fill);
-        fmt::format_to(std::back_inserter(os), "\" ");
+        m_style(t_polygon.line, t_polygon.line_id, t_polygon.fill);
+        write_to(os, " ");
 
-        fmt::format_to(std::back_inserter(os), "/>");
+        write_to(os, "/>");
     }
 
     void RendererSVG::path(const Path &t_path)
     {
-        fmt::format_to(std::back_inserter(os), "<path d=\"");
+        auto nper = t_path.nper;
+        const auto points = m_simplify.path(t_path.points, nper);
+        write_to(os, "<path d=\"");
 
-        auto it_poly = t_path.nper.begin();
+        auto it_poly = nper.begin();
         std::size_t left = 0;
-        for (auto it = t_path.points.begin(); it != t_path.points.end(); ++it)
+        for (auto it = points.begin(); it != points.end(); ++it)
         {
             if (left == 0)
             {
                 left = (*it_poly) - 1;
                 ++it_poly;
-                fmt::format_to(std::back_inserter(os), "M{:.2f} {:.2f}", it->x, it->y);
+                write_to(os, "M", m_coord(it->x), " ", m_coord(it->y));
             }
             else
             {
                 --left;
-                fmt::format_to(std::back_inserter(os), "L{:.2f} {:.2f}", it->x, it->y);
+                write_to(os, "L", m_coord(it->x), " ", m_coord(it->y));
 
                 if (left == 0)
                 {
-                    fmt::format_to(std::back_inserter(os), "Z");
+                    write_to(os, "Z");
                 }
             }
         }
 
         // Finish path data
-        fmt::format_to(std::back_inserter(os), "\" style=\"");
-        css_lineinfo(os, t_path.line);
+        if (m_css_classes)
+        {
+            write_to(os, "\" ");
+            m_style(t_path.line, t_path.line_id, t_path.fill);
+            write_to(os, " fill-rule=\"", t_path.winding ? "nonzero" : "evenodd", "\"/>");
+            return;
+        }
+        write_to(os, "\" style=\"");
+        css_lineinfo(os, t_path.line, m_coord);
         css_fill_or_omit(os, t_path.fill);
-        fmt::format_to(std::back_inserter(os), "fill-rule: ");
-        fmt::format_to(std::back_inserter(os), t_path.winding ? "nonzero" : "evenodd");
-        fmt::format_to(std::back_inserter(os), ";\"/>");
+        write_to(os, "fill-rule: ");
+        write_to(os, t_path.winding ? "nonzero" : "evenodd");
+        write_to(os, ";\"/>");
     }
     
+    static inline void write_raster_href(fmt::memory_buffer &os, const Raster &t_raster, const RenderOptions &t_options, page_id_t t_page_id)
+    {
+        write_raster_href(os, fmt::format("id={}&hash={:016x}{}", t_page_id, t_raster.hash, t_options.fast_png ? "&fastpng=true" : ""),
+                          t_options, [&] { return raster_base64(t_raster, t_options.fast_png); });
+    }
+
     void RendererSVG::raster(const Raster &t_raster)
     {
         // If we specify the clip path inside <image>, the "transform" also
         // affects the clip path, so we need to specify clip path at an outer level
         // (according to svglite)
-        fmt::format_to(std::back_inserter(os), "<g><image ");
-        fmt::format_to(std::back_inserter(os), R""( x="{:.2f}" y="{:.2f}" width="{:.2f}" height="{:.2f}" )"",
-                   t_raster.rect.x,
-                   t_raster.rect.y,
-                   t_raster.rect.width,
-                   t_raster.rect.height);
-        fmt::format_to(std::back_inserter(os), R""(preserveAspectRatio="none" )"");
+        write_to(os, "<g><image ");
+        write_to(os, R""( x=")"", m_coord(t_raster.rect.x), R""(" y=")"", m_coord(t_raster.rect.y), R""(" width=")"",
+                 m_coord(t_raster.rect.width), R""(" height=")"", m_coord(t_raster.rect.height), R""(" )"");
+        write_to(os, R""(preserveAspectRatio="none" )"");
         if (!t_raster.interpolate)
         {
-            fmt::format_to(std::back_inserter(os), R""(image-rendering="pixelated" )"");
+            write_to(os, R""(image-rendering="pixelated" )"");
         }
         if (t_raster.rot != 0)
         {
-            fmt::format_to(std::back_inserter(os), R""(transform="rotate({:.2f},{:.2f},{:.2f})" )"", -1.0 * t_raster.rot, t_raster.rect.x, t_raster.rect.y);
+            write_to(os, R""(transform="rotate()"", fixed2(-1.0 * t_raster.rot), ",", m_coord(t_raster.rect.x), ",",
+                     m_coord(t_raster.rect.y), R""()" )"");
         }
-        fmt::format_to(std::back_inserter(os), " xlink:href=\"data:image/png;base64,");
-        fmt::format_to(std::back_inserter(os), raster_base64(t_raster));
-        fmt::format_to(std::back_inserter(os), "\"/></g>");
+        write_raster_href(os, t_raster, m_options, m_page_id);
+        write_to(os, "\"/></g>");
     }
 
     // Portable SVG renderer
@@ -430,14 +759,14 @@ namespace httpgd::dc
         int alpha = color::alpha(col);
         if (alpha == 0)
         {
-            fmt::format_to(std::back_inserter(os), R""( fill="none")"");
+            write_to(os, R""( fill="none")"");
         }
         else
         {
-            fmt::format_to(std::back_inserter(os), R""( fill="#{:02X}{:02X}{:02X}")"", color::red(col), color::green(col), color::blue(col));
+            write_to(os, R""( fill=")"", hex_color(col), "\"");
             if (alpha != color::byte_mask)
             {
-                fmt::format_to(std::back_inserter(os), R""( fill-opacity="{:.2f}")"", color::byte_frac(alpha));
+                write_to(os, R""( fill-opacity=")"", fixed2(color::byte_frac(alpha)), "\"");
             }
         }
     }
@@ -447,28 +776,28 @@ namespace httpgd::dc
         int alpha = color::alpha(col);
         if (alpha != 0)
         {
-            fmt::format_to(std::back_inserter(os), R""( fill="#{:02X}{:02X}{:02X}")"", color::red(col), color::green(col), color::blue(col));
+            write_to(os, R""( fill=")"", hex_color(col), "\"");
             if (alpha != color::byte_mask)
             {
-                fmt::format_to(std::back_inserter(os), R""( fill-opacity="{:.2f}")"", color::byte_frac(alpha));
+                write_to(os, R""( fill-opacity=")"", fixed2(color::byte_frac(alpha)), "\"");
             }
         }
     }
 
-    static inline void att_lineinfo(fmt::memory_buffer &os, const LineInfo &line)
+    static inline void att_lineinfo(fmt::memory_buffer &os, const LineInfo &line, const CoordFormat &coord)
     {
 
         // 1 lwd = 1/96", but units in rest of document are 1/72"
-        fmt::format_to(std::back_inserter(os), R""(stroke-width="{:.2f}")"", line.lwd / 96.0 * 72);
+        write_to(os, R""(stroke-width=")"", coord(line.lwd / 96.0 * 72), "\"");
 
         // Default is "stroke: none;"
         color_t alpha = color::alpha(line.col);
         if (alpha != 0)
         {
-            fmt::format_to(std::back_inserter(os), R""( stroke="#{:02X}{:02X}{:02X}")"", color::red(line.col), color::green(line.col), color::blue(line.col));
+            write_to(os, R""( stroke=")"", hex_color(line.col), "\"");
             if (alpha != color::byte_mask)
             {
-                fmt::format_to(std::back_inserter(os), R""( stroke-opacity="{:.2f}")"", color::byte_frac(alpha));
+                write_to(os, R""( stroke-opacity=")"", fixed2(color::byte_frac(alpha)), "\"");
             }
         }
         
@@ -482,15 +811,15 @@ namespace httpgd::dc
         default:
             // For details
             // https://github.com/wch/r-source/blob/trunk/src/include/R_ext/GraphicsEngine.h#L337
-            fmt::format_to(std::back_inserter(os), R""( stroke-dasharray="{:.2f})"", scale_lty(lty, line.lwd));
+            write_to(os, R""( stroke-dasharray=")"", coord(scale_lty(lty, line.lwd)));
             lty = lty >> 4;
             // Remaining numbers
             for (int i = 1; i < 8 && lty & 15; i++)
             {
-                fmt::format_to(std::back_inserter(os), ", {:.2f}", scale_lty(lty, line.lwd));
+                write_to(os, ", ", coord(scale_lty(lty, line.lwd)));
                 lty = lty >> 4;
             }
-            fmt::format_to(std::back_inserter(os), "\"");
+            write_to(os, "\"");
             break;
         }
 
@@ -498,13 +827,13 @@ namespace httpgd::dc
         switch (line.lend)
         {
         case LineInfo::GC_ROUND_CAP:
-            fmt::format_to(std::back_inserter(os), R""( stroke-linecap="round")"");
+            write_to(os, R""( stroke-linecap="round")"");
             break;
         case LineInfo::GC_BUTT_CAP:
             // SVG default
             break;
         case LineInfo::GC_SQUARE_CAP:
-            fmt::format_to(std::back_inserter(os), R""( stroke-linecap="square")"");
+            write_to(os, R""( stroke-linecap="square")"");
             break;
         default:
             break;
@@ -514,16 +843,16 @@ namespace httpgd::dc
         switch (line.ljoin)
         {
         case LineInfo::GC_ROUND_JOIN: 
-            fmt::format_to(std::back_inserter(os), R""( stroke-linejoin="round")"");
+            write_to(os, R""( stroke-linejoin="round")"");
             break;
         case LineInfo::GC_BEVEL_JOIN:
-            fmt::format_to(std::back_inserter(os), R""( stroke-linejoin="bevel")"");
+            write_to(os, R""( stroke-linejoin="bevel")"");
             break;
         case LineInfo::GC_MITRE_JOIN:
             // default
             if (std::fabs(line.lmitre - 4.0) > 1e-3)
             { // 4 is the SVG default
-                fmt::format_to(std::back_inserter(os), R""( stroke-miterlimit="{:.2f}")"", line.lmitre);
+                write_to(os, R""( stroke-miterlimit=")"", fixed2(line.lmitre), "\"");
             }
             break;
         default:
@@ -532,8 +861,8 @@ namespace httpgd::dc
     }
 
     
-    RendererSVGPortable::RendererSVGPortable() 
-        : os()
+    RendererSVGPortable::RendererSVGPortable(const RenderOptions &t_options)
+        : os(), m_options(t_options), m_coord(t_options), m_simplify(t_options.simplify), m_cull(t_options.cull)
     {
     }
     
@@ -541,6 +870,8 @@ namespace httpgd::dc
     {
         m_unique_id = httpgd::rng::uuid();
         m_scale = t_scale;
+        m_simplify.set_scale(t_scale);
+        m_cull.begin(t_page, t_scale);
         this->page(t_page);
     }
     
@@ -548,61 +879,96 @@ namespace httpgd::dc
     {
         return fmt::to_string(os);
     }
+
+    std::string RendererSVGPortable::take_string()
+    {
+        auto out = fmt::to_string(os);
+        os = fmt::memory_buffer(); // release the buffer right away
+        return out;
+    }
     
     void RendererSVGPortable::page(const Page &t_page) 
     {
-        os.reserve((t_page.dcs.size() + t_page.cps.size()) * 128 + 512);
-        fmt::format_to(std::back_inserter(os), R""(<svg xmlns="http://www.w3.org/2000/svg" xmlns:xlink="http://www.w3.org/1999/xlink" class="httpgd" )"");
-        fmt::format_to(std::back_inserter(os),
-                   R""(width="{:.2f}" height="{:.2f}" viewBox="0 0 {:.2f} {:.2f}">)"" "\n<defs>\n",
-                   t_page.size.x * m_scale, t_page.size.y * m_scale, t_page.size.x, t_page.size.y);
+        m_page_id = t_page.id;
+        if (m_chunk_size == 0 && !m_options.viewport)
+        {
+            os.reserve((t_page.dcs.size() + t_page.cps.size()) * 128 + 512);
+        }
+        write_to(os, R""(<svg xmlns="http://www.w3.org/2000/svg" xmlns:xlink="http://www.w3.org/1999/xlink" class="httpgd" )"");
+        const auto area = render_area(t_page, m_options.viewport);
+        write_to(os, R""(width=")"", fixed2(area.width * m_scale), R""(" height=")"", fixed2(area.height * m_scale), R""(" viewBox=")"");
+        if (m_options.viewport)
+        {
+            write_to(os, m_coord(area.x), " ", m_coord(area.y), " ");
+        }
+        else
+        {
+            write_to(os, "0 0 ");
+        }
+        write_to(os, m_coord(area.width), " ", m_coord(area.height), "\">\n<defs>\n");
 
         for (const auto &cp : t_page.cps)
         {
-            fmt::format_to(std::back_inserter(os), R""(<clipPath id="c{:d}-{}"><rect x="{:.2f}" y="{:.2f}" width="{:.2f}" height="{:.2f}"/></clipPath>)"" "\n",
-                    cp.id,
-                    m_unique_id,
-                    cp.rect.x,
-                    cp.rect.y,
-                    cp.rect.width,
-                    cp.rect.height);
+            write_to(os, R""(<clipPath id="c)"", cp.id, "-", m_unique_id, R""("><rect x=")"", m_coord(cp.rect.x), R""(" y=")"",
+                     m_coord(cp.rect.y), R""(" width=")"", m_coord(cp.rect.width), R""(" height=")"", m_coord(cp.rect.height),
+                     "\"/></clipPath>\n");
         }
-        fmt::format_to(std::back_inserter(os), "</defs>\n");
-        fmt::format_to(std::back_inserter(os), R""(<rect width="100%" height="100%" stroke="none" fill="#{:02X}{:02X}{:02X}"/>)"" "\n",
-                   color::red(t_page.fill), color::green(t_page.fill), color::blue(t_page.fill));
+        write_to(os, "</defs>\n");
+        write_to(os, "<rect ");
+        if (m_options.viewport)
+        {
+            write_to(os, R""(x=")"", m_coord(m_options.viewport->x), R""(" y=")"", m_coord(m_options.viewport->y), "\" ");
+        }
+        write_to(os, R""(width="100%" height="100%" stroke="none" fill=")"", hex_color(t_page.fill), "\"/>\n");
 
         clip_id_t last_id = t_page.cps.front().id;
-        fmt::format_to(std::back_inserter(os), R""(<g clip-path="url(#c{:d}-{})">)"" "\n", last_id, m_unique_id);
-        for (const auto &dc : t_page.dcs)
+        write_to(os, R""(<g clip-path="url(#c)"", last_id, "-", m_unique_id, ")\">\n");
+        const VisibleDrawCalls dcs(t_page, m_options.viewport);
+        RasterLayers layers(dcs.get(), m_options);
+        for (auto it = dcs.begin(); it != dcs.end();)
         {
-            if (dc->clip_id != last_id)
+            const auto layer_end = layers.layer_end(it);
+            if (layer_end == it && m_cull.skip(t_page, *it))
+            {
+                ++it;
+                continue;
+            }
+            if (it->clip_id != last_id)
+            {
+                write_to(os, R""(</g><g clip-path="url(#c)"", it->clip_id, "-", m_unique_id, ")\">\n");
+                last_id = it->clip_id;
+            }
+            if (layer_end != it)
             {
-                fmt::format_to(std::back_inserter(os), R""(</g><g clip-path="url(#c{:d}-{})">)"" "\n", dc->clip_id, m_unique_id);
-                last_id = dc->clip_id;
+                write_raster_layer(os, t_page, dcs.get(), it, layer_end, m_scale, m_options, m_coord);
+                it = layer_end;
             }
-            dc->render(this);
-            fmt::format_to(std::back_inserter(os), "\n");
+            else
+            {
+                t_page.render(*it, this);
+                ++it;
+            }
+            write_to(os, "\n");
+            m_drain(os, false);
         }
-        fmt::format_to(std::back_inserter(os), "</g>\n</svg>");
+        write_to(os, "</g>\n</svg>");
+        m_drain(os, true);
     }
-    
+
     void RendererSVGPortable::dc(const DrawCall &t_dc) 
     {
-        fmt::format_to(std::back_inserter(os), "<!-- unknown draw call -->");
+        write_to(os, "<!-- unknown draw call -->");
     }
     
     void RendererSVGPortable::rect(const Rect &t_rect) 
     {
-        fmt::format_to(std::back_inserter(os), "<rect ");
-        fmt::format_to(std::back_inserter(os), R""(x="{:.2f}" y="{:.2f}" width="{:.2f}" height="{:.2f}" )"",
-                   t_rect.rect.x,
-                   t_rect.rect.y,
-                   t_rect.rect.width,
-                   t_rect.rect.height);
+        write_to(os, "<rect ");
+        write_to(os, R""(x=")"", m_coord(t_rect.rect.x), R""(" y=")"", m_coord(t_rect.rect.y), R""(" width=")"",
+                 m_coord(t_rect.rect.width), R""(" height=")"", m_coord(t_rect.rect.height), R""(" )"");
 
-        att_lineinfo(os, t_rect.line);
+        att_lineinfo(os, t_rect.line, m_coord);
         att_fill_or_none(os, t_rect.fill);
-        fmt::format_to(std::back_inserter(os), "/>");
+        write_to(os, "/>");
     }
     
     void RendererSVGPortable::text(const Text &t_text) 
@@ -610,42 +976,43 @@ namespace httpgd::dc
         // If we specify the clip path inside <image>, the "transform" also
         // affects the clip path, so we need to specify clip path at an outer level
         // (according to svglite)
-        fmt::format_to(std::back_inserter(os), "<g><text ");
+        write_to(os, "<g><text ");
 
         if (t_text.rot == 0.0)
         {
-            fmt::format_to(std::back_inserter(os), R""(x="{:.2f}" y="{:.2f}" )"", t_text.pos.x, t_text.pos.y);
+            write_to(os, R""(x=")"", m_coord(t_text.pos.x), R""(" y=")"", m_coord(t_text.pos.y), R""(" )"");
         }
         else
         {
-            fmt::format_to(std::back_inserter(os), R""(transform="translate({:.2f},{:.2f}) rotate({:.2f})" )"", t_text.pos.x, t_text.pos.y, t_text.rot * -1.0);
+            write_to(os, R""(transform="translate()"", m_coord(t_text.pos.x), ",", m_coord(t_text.pos.y), ") rotate(",
+                     fixed2(t_text.rot * -1.0), R""()" )"");
         }
 
         if (t_text.hadj == 0.5)
         {
-            fmt::format_to(std::back_inserter(os), R""(text-anchor="middle" )"");
+            write_to(os, R""(text-anchor="middle" )"");
         }
         else if (t_text.hadj == 1)
         {
-            fmt::format_to(std::back_inserter(os), R""(text-anchor="end" )"");
+            write_to(os, R""(text-anchor="end" )"");
         }
 
-        fmt::format_to(std::back_inserter(os), R""(font-family="{}" font-size="{:.2f}px")"", t_text.text.font_family, t_text.text.fontsize);
+        write_to(os, R""(font-family=")"", t_text.text.font_family, R""(" font-size=")"", m_coord(t_text.text.fontsize), R""(px")"");
 
         if (t_text.text.weight != 400)
         {
             if (t_text.text.weight == 700)
             {
-                fmt::format_to(std::back_inserter(os), R""( font-weight="bold")"");
+                write_to(os, R""( font-weight="bold")"");
             }
             else
             {
-                fmt::format_to(std::back_inserter(os), R""( font-weight="{}")"", t_text.text.weight);
+                write_to(os, R""( font-weight=")"", t_text.text.weight, "\"");
             }
         }
         if (t_text.text.italic)
         {
-            fmt::format_to(std::back_inserter(os), R""( font-style="italic")"");
+            write_to(os, R""( font-style="italic")"");
         }
         if (t_text.col != color::rgb(0, 0, 0))
         {
@@ -653,102 +1020,108 @@ namespace httpgd::dc
         }
         if (t_text.text.features.length() > 0)
         {
-            fmt::format_to(std::back_inserter(os), R""( font-feature-settings="{}")"", t_text.text.features);
+            write_to(os, R""( font-feature-settings=")"", t_text.text.features, "\"");
         }
-        if (t_text.text.txtwidth_px > 0)
+        if (t_text.txtwidth_px > 0)
         {
-            fmt::format_to(std::back_inserter(os), R""( textLength="{:.2f}px" lengthAdjust="spacingAndGlyphs")"", t_text.text.txtwidth_px);
+            write_to(os, R""( textLength=")"", m_coord(t_text.txtwidth_px), R""(px" lengthAdjust="spacingAndGlyphs")"");
         }
-        fmt::format_to(std::back_inserter(os), ">");
+        write_to(os, ">");
         write_xml_escaped(os, t_text.str);
-        fmt::format_to(std::back_inserter(os), "</text></g>");
+        write_to(os, "</text></g>");
     }
     
     void RendererSVGPortable::circle(const Circle &t_circle)
     {
-        fmt::format_to(std::back_inserter(os), "<circle ");
-        fmt::format_to(std::back_inserter(os), R""(cx="{:.2f}" cy="{:.2f}" r="{:.2f}" )"", t_circle.pos.x, t_circle.pos.y, t_circle.radius);
+        write_to(os, "<circle ");
+        write_to(os, R""(cx=")"", m_coord(t_circle.pos.x), R""(" cy=")"", m_coord(t_circle.pos.y), R""(" r=")"",
+                 m_coord(t_circle.radius), R""(" )"");
 
-        att_lineinfo(os, t_circle.line);
+        att_lineinfo(os, t_circle.line, m_coord);
         att_fill_or_none(os, t_circle.fill);
-        fmt::format_to(std::back_inserter(os), "/>");
+        write_to(os, "/>");
     }
 
     void RendererSVGPortable::line(const Line &t_line)
     {
-        fmt::format_to(std::back_inserter(os), "<line ");
-        fmt::format_to(std::back_inserter(os), R""(x1="{:.2f}" y1="{:.2f}" x2="{:.2f}" y2="{:.2f}" )"", t_line.orig.x, t_line.orig.y, t_line.dest.x, t_line.dest.y);
+        write_to(os, "<line ");
+        write_to(os, R""(x1=")"", m_coord(t_line.orig.x), R""(" y1=")"", m_coord(t_line.orig.y), R""(" x2=")"",
+                 m_coord(t_line.dest.x), R""(" y2=")"", m_coord(t_line.dest.y), R""(" )"");
 
-        att_lineinfo(os, t_line.line);
-        fmt::format_to(std::back_inserter(os), "/>");
+        att_lineinfo(os, t_line.line, m_coord);
+        write_to(os, "/>");
     }
     
     void RendererSVGPortable::polyline(const Polyline &t_polyline) 
     {
-        fmt::format_to(std::back_inserter(os), "<polyline points=\"");
-        for (auto it = t_polyline.points.begin(); it != t_polyline.points.end(); ++it)
+        const auto points = m_simplify.points(t_polyline.points);
+        write_to(os, "<polyline points=\"");
+        for (auto it = points.begin(); it != points.end(); ++it)
         {
-            if (it != t_polyline.points.begin())
+            if (it != points.begin())
             {
-                fmt::format_to(std::back_inserter(os), " ");
+                write_to(os, " ");
             }
-            fmt::format_to(std::back_inserter(os), "{:.2f},{:.2f}", it->x, it->y);
+            write_to(os, m_coord(it->x), ",", m_coord(it->y));
         }
-        fmt::format_to(std::back_inserter(os), "\" fill=\"none\" ");
-        att_lineinfo(os, t_polyline.line);
-        fmt::format_to(std::back_inserter(os), "/>");
+        write_to(os, "\" fill=\"none\" ");
+        att_lineinfo(os, t_polyline.line, m_coord);
+        write_to(os, "/>");
     }
     
     void RendererSVGPortable::polygon(const Polygon &t_polygon) 
     {
-        fmt::format_to(std::back_inserter(os), "<polygon points=\"");
-        for (auto it = t_polygon.points.begin(); it != t_polygon.points.end(); ++it)
+        const auto points = m_simplify.points(t_polygon.points);
+        write_to(os, "<polygon points=\"");
+        for (auto it = points.begin(); it != points.end(); ++it)
         {
-            if (it != t_polygon.points.begin())
+            if (it != points.begin())
             {
-                fmt::format_to(std::back_inserter(os), " ");
+                write_to(os, " ");
             }
-            fmt::format_to(std::back_inserter(os), "{:.2f},{:.2f}", it->x, it->y);
+            write_to(os, m_coord(it->x), ",", m_coord(it->y));
         }
-        fmt::format_to(std::back_inserter(os), "\" ");
-        att_lineinfo(os, t_polygon.line);
+        write_to(os, "\" ");
+        att_lineinfo(os, t_polygon.line, m_coord);
         att_fill_or_none(os, t_polygon.fill);
-        fmt::format_to(std::back_inserter(os), "/>");
+        write_to(os, "/>");
     }
     
     void RendererSVGPortable::path(const Path &t_path) 
     {
-        fmt::format_to(std::back_inserter(os), "<path d=\"");
+        auto nper = t_path.nper;
+        const auto points = m_simplify.path(t_path.points, nper);
+        write_to(os, "<path d=\"");
 
-        auto it_poly = t_path.nper.begin();
+        auto it_poly = nper.begin();
         std::size_t left = 0;
-        for (auto it = t_path.points.begin(); it != t_path.points.end(); ++it)
+        for (auto it = points.begin(); it != points.end(); ++it)
         {
             if (left == 0)
             {
                 left = (*it_poly) - 1;
                 ++it_poly;
-                fmt::format_to(std::back_inserter(os), "M{:.2f} {:.2f}", it->x, it->y);
+                write_to(os, "M", m_coord(it->x), " ", m_coord(it->y));
             }
             else
             {
                 --left;
-                fmt::format_to(std::back_inserter(os), "L{:.2f} {:.2f}", it->x, it->y);
+                write_to(os, "L", m_coord(it->x), " ", m_coord(it->y));
 
                 if (left == 0)
                 {
-                    fmt::format_to(std::back_inserter(os), "Z");
+                    write_to(os, "Z");
                 }
             }
         }
 
         // Finish path data
-        fmt::format_to(std::back_inserter(os), "\" ");
-        att_lineinfo(os, t_path.line);
+        write_to(os, "\" ");
+        att_lineinfo(os, t_path.line, m_coord);
         att_fill_or_none(os, t_path.fill);
-        fmt::format_to(std::back_inserter(os), " fill-rule=\"");
-        fmt::format_to(std::back_inserter(os), t_path.winding ? "nonzero" : "evenodd");
-        fmt::format_to(std::back_inserter(os), "\"/>");
+        write_to(os, " fill-rule=\"");
+        write_to(os, t_path.winding ? "nonzero" : "evenodd");
+        write_to(os, "\"/>");
     }
     
     void RendererSVGPortable::raster(const Raster &t_raster) 
@@ -756,44 +1129,83 @@ namespace httpgd::dc
         // If we specify the clip path inside <image>, the "transform" also
         // affects the clip path, so we need to specify clip path at an outer level
         // (according to svglite)
-        fmt::format_to(std::back_inserter(os), "<g><image ");
-        fmt::format_to(std::back_inserter(os), R""( x="{:.2f}" y="{:.2f}" width="{:.2f}" height="{:.2f}" )"",
-                   t_raster.rect.x,
-                   t_raster.rect.y,
-                   t_raster.rect.width,
-                   t_raster.rect.height);
-        fmt::format_to(std::back_inserter(os), R""(preserveAspectRatio="none" )"");
+        write_to(os, "<g><image ");
+        write_to(os, R""( x=")"", m_coord(t_raster.rect.x), R""(" y=")"", m_coord(t_raster.rect.y), R""(" width=")"",
+                 m_coord(t_raster.rect.width), R""(" height=")"", m_coord(t_raster.rect.height), R""(" )"");
+        write_to(os, R""(preserveAspectRatio="none" )"");
         if (!t_raster.interpolate)
         {
-            fmt::format_to(std::back_inserter(os), R""(image-rendering="pixelated" )"");
+            write_to(os, R""(image-rendering="pixelated" )"");
         }
         if (t_raster.rot != 0)
         {
-            fmt::format_to(std::back_inserter(os), R""(transform="rotate({:.2f},{:.2f},{:.2f})" )"", -1.0 * t_raster.rot, t_raster.rect.x, t_raster.rect.y);
+            write_to(os, R""(transform="rotate()"", fixed2(-1.0 * t_raster.rot), ",", m_coord(t_raster.rect.x), ",",
+                     m_coord(t_raster.rect.y), R""()" )"");
         }
-        fmt::format_to(std::back_inserter(os), " xlink:href=\"data:image/png;base64,");
-        fmt::format_to(std::back_inserter(os), raster_base64(t_raster));
-        fmt::format_to(std::back_inserter(os), "\"/></g>");
+        write_raster_href(os, t_raster, m_options, m_page_id);
+        write_to(os, "\"/></g>");
+    }
+
+    RendererSVGZ::RendererSVGZ(boost::optional<std::string> t_extra_css, const RenderOptions &t_options) :
+        RendererSVG(t_extra_css, false, t_options)
+    {
+        m_chunk_size = 64 * 1024;
     }
 
-    RendererSVGZ::RendererSVGZ(boost::optional<std::string> t_extra_css) :
-        RendererSVG(t_extra_css)
+    void RendererSVGZ::render(const Page &t_page, double t_scale)
     {
+        m_gzip = std::make_unique<compr::GzipStream>();
+        RendererSVG::render(t_page, t_scale);
+        m_render_data = m_gzip->finish();
+        m_gzip.reset();
     }
     
     std::vector<unsigned char> RendererSVGZ::get_binary() const 
     {
-        return compr::compress_str(RendererSVG::get_string());
+        return m_render_data;
+    }
+
+    std::vector<unsigned char> RendererSVGZ::take_binary()
+    {
+        std::vector<unsigned char> out;
+        out.swap(m_render_data);
+        return out;
+    }
+
+    void RendererSVGZ::m_flush(const char *t_data, std::size_t t_size)
+    {
+        m_gzip->write(t_data, t_size);
     }
     
-    RendererSVGZPortable::RendererSVGZPortable() :
-        RendererSVGPortable()
+    RendererSVGZPortable::RendererSVGZPortable(const RenderOptions &t_options) :
+        RendererSVGPortable(t_options)
+    {
+        m_chunk_size = 64 * 1024;
+    }
+
+    void RendererSVGZPortable::render(const Page &t_page, double t_scale)
     {
+        m_gzip = std::make_unique<compr::GzipStream>();
+        RendererSVGPortable::render(t_page, t_scale);
+        m_render_data = m_gzip->finish();
+        m_gzip.reset();
     }
     
     std::vector<unsigned char> RendererSVGZPortable::get_binary() const 
     {
-        return compr::compress_str(RendererSVGPortable::get_string());
+        return m_render_data;
+    }
+
+    std::vector<unsigned char> RendererSVGZPortable::take_binary()
+    {
+        std::vector<unsigned char> out;
+        out.swap(m_render_data);
+        return out;
+    }
+
+    void RendererSVGZPortable::m_flush(const char *t_data, std::size_t t_size)
+    {
+        m_gzip->write(t_data, t_size);
     }
 
 } // namespace httpgd::dc
@@ -2,19 +2,40 @@
 #define RENDERER_SVG_H
 
 #include "DrawData.h"
+#include "Cull.h"
+#include "HttpgdCompress.h"
+#include "Simplify.h"
+#include "TextWriter.h"
 #include <fmt/format.h>
 #include <boost/optional.hpp>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace httpgd::dc
 {
+    // PNG image of the dense layer with hash t_hash (written by the SVG
+    // renderers with RenderOptions::raster_url), empty if the page has none.
+    std::vector<unsigned char> raster_layer_png(const Page &t_page, std::uint64_t t_hash, double t_scale, const RenderOptions &t_options);
+
+    /**
+     * SVG renderer. Element styles are either written as inline style
+     * attributes or, if t_css_classes is set, collected and declared
+     * once as CSS classes in the style block (more compact output).
+     * Streaming is not supported with CSS classes (the head is written last).
+     * The number format of coordinates, the simplification of lines,
+     * culling and the embedding of dense layers as images are set with
+     * t_options.
+     */
     class RendererSVG : public Renderer, public StringRenderingTarget
     {
     public:
-        explicit RendererSVG(boost::optional<std::string> t_extra_css);
+        RendererSVG(boost::optional<std::string> t_extra_css, bool t_css_classes, const RenderOptions &t_options = {});
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::string get_string() const override;
+        std::string take_string() override;
 
         // Renderer
         void page(const Page &t_page) override;
@@ -32,6 +53,25 @@ namespace httpgd::dc
         fmt::memory_buffer os;
         boost::optional<std::string> m_extra_css;
         double m_scale;
+        RenderOptions m_options;
+        CoordFormat m_coord;
+        Simplifier m_simplify;
+        Culler m_cull;
+        page_id_t m_page_id = 0;
+
+        bool m_css_classes;
+        // style rules are scoped to the document (id="plot-<page id>-<version>"),
+        // so several plots can be embedded in one HTML page while renders
+        // of the same page version stay identical
+        std::string m_unique_id;
+        std::vector<color_t> m_fills;
+        std::unordered_map<color_t, std::size_t> m_fill_classes;
+
+        void m_page_head(const Page &t_page);
+        void m_page_body(const Page &t_page);
+        std::size_t m_fill_class(color_t t_fill);
+        void m_style(const LineInfo &t_line, style_id_t t_line_id);
+        void m_style(const LineInfo &t_line, style_id_t t_line_id, color_t t_fill);
     };
 
     /**
@@ -43,10 +83,11 @@ namespace httpgd::dc
     class RendererSVGPortable : public Renderer, public StringRenderingTarget
     {
     public:
-        RendererSVGPortable();
+        explicit RendererSVGPortable(const RenderOptions &t_options = {});
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::string get_string() const override;
+        std::string take_string() override;
 
         // Renderer
         void page(const Page &t_page) override;
@@ -63,23 +104,50 @@ namespace httpgd::dc
     private:
         fmt::memory_buffer os;
         double m_scale;
+        RenderOptions m_options;
+        CoordFormat m_coord;
+        Simplifier m_simplify;
+        Culler m_cull;
+        page_id_t m_page_id = 0;
         std::string m_unique_id;
     };
 
+    /**
+     * Compresses the SVG while it is written, only the compressed
+     * document is held in memory.
+     */
     class RendererSVGZ : public RendererSVG, public BinaryRenderingTarget
     {
     public:
-        explicit RendererSVGZ(boost::optional<std::string> t_extra_css);
+        explicit RendererSVGZ(boost::optional<std::string> t_extra_css, const RenderOptions &t_options = {});
+        void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::vector<unsigned char> get_binary() const override;
+        std::vector<unsigned char> take_binary() override;
+
+    protected:
+        void m_flush(const char *t_data, std::size_t t_size) override;
+
+    private:
+        std::unique_ptr<compr::GzipStream> m_gzip;
+        std::vector<unsigned char> m_render_data{};
     };
     
     class RendererSVGZPortable : public RendererSVGPortable, public BinaryRenderingTarget
     {
     public:
-        RendererSVGZPortable();
+        explicit RendererSVGZPortable(const RenderOptions &t_options = {});
+        void render(const Page &t_page, double t_scale) override;
         [[nodiscard]] 
         std::vector<unsigned char> get_binary() const override;
+        std::vector<unsigned char> take_binary() override;
+
+    protected:
+        void m_flush(const char *t_data, std::size_t t_size) override;
+
+    private:
+        std::unique_ptr<compr::GzipStream> m_gzip;
+        std::vector<unsigned char> m_render_data{};
     };
     
 } // namespace httpgd::dc
@@ -12,6 +12,7 @@ namespace httpgd::dc
         void render(const Page &t_page, double t_scale) override;
         [[nodiscard]]
         std::string get_string() const override;
+        std::string take_string() override;
 
         // Renderer
         void page(const Page &t_page) override;
@@ -0,0 +1,107 @@
+#include "Simplify.h"
+
+#include <cmath>
+
+namespace httpgd::dc
+{
+    // Polylines with fewer vertices are not worth the pass
+    static constexpr std::size_t min_vertices = 16;
+
+    Simplifier::Simplifier(double t_tolerance_px)
+        : m_tolerance_px(t_tolerance_px)
+    {
+    }
+
+    void Simplifier::set_scale(double t_scale)
+    {
+        const double tolerance = m_tolerance_px / t_scale;
+        m_tolerance = (tolerance > 0 && std::isfinite(tolerance)) ? tolerance : 0;
+    }
+
+    bool Simplifier::enabled() const
+    {
+        return m_tolerance > 0;
+    }
+
+    Span<gvertex<double>> Simplifier::points(Span<gvertex<double>> t_points)
+    {
+        if (!enabled() || t_points.size() < min_vertices)
+        {
+            return t_points;
+        }
+        m_points.clear();
+        m_append(t_points.begin(), t_points.end());
+        if (m_points.size() == t_points.size())
+        {
+            return t_points;
+        }
+        return {m_points.data(), m_points.size()};
+    }
+
+    Span<gvertex<double>> Simplifier::path(Span<gvertex<double>> t_points, Span<int> &t_nper)
+    {
+        if (!enabled() || t_points.size() < min_vertices)
+        {
+            return t_points;
+        }
+        m_points.clear();
+        m_nper.clear();
+        const auto *it = t_points.begin();
+        for (const int n : t_nper)
+        {
+            const auto before = m_points.size();
+            m_append(it, it + n);
+            m_nper.push_back(static_cast<int>(m_points.size() - before));
+            it += n;
+        }
+        if (m_points.size() == t_points.size())
+        {
+            return t_points;
+        }
+        t_nper = {m_nper.data(), m_nper.size()};
+        return {m_points.data(), m_points.size()};
+    }
+
+    void Simplifier::m_append(const gvertex<double> *t_begin, const gvertex<double> *t_end)
+    {
+        const auto *it = t_begin;
+        while (it != t_end)
+        {
+            // find the run of vertices in the same column
+            const double column = std::floor(it->x / m_tolerance);
+            const auto *first = it;
+            const auto *lowest = it;
+            const auto *highest = it;
+            for (++it; it != t_end && std::floor(it->x / m_tolerance) == column; ++it)
+            {
+                if (it->y < lowest->y)
+                {
+                    lowest = it;
+                }
+                if (it->y > highest->y)
+                {
+                    highest = it;
+                }
+            }
+            const auto *last = it - 1;
+
+            // keep the extremes in drawing order
+            const auto *mid_a = lowest < highest ? lowest : highest;
+            const auto *mid_b = lowest < highest ? highest : lowest;
+            m_points.push_back(*first);
+            if (mid_a != first)
+            {
+                m_points.push_back(*mid_a);
+            }
+            if (mid_b != mid_a && mid_b != first)
+            {
+                m_points.push_back(*mid_b);
+            }
+            if (last != mid_b && last != first)
+            {
+                m_points.push_back(*last);
+            }
+        }
+    }
+
+} // namespace httpgd::dc
@@ -0,0 +1,48 @@
+#ifndef HTTPGD_SIMPLIFY_H
+#define HTTPGD_SIMPLIFY_H
+
+#include "DrawData.h"
+#include "HttpgdGeom.h"
+
+#include <vector>
+
+namespace httpgd::dc
+{
+    /**
+     * Reduces the vertices of polylines, polygons and paths at render
+     * time, the stored page is not modified.
+     * Consecutive vertices that fall into the same column of width
+     * t_tolerance_px (output pixels) are replaced by the first, lowest, highest and last
+     * of them (in their original order). This keeps the drawn extent
+     * of every column, so the result looks the same at that resolution
+     * while dense lines (e.g. long time series) shrink to at
+     * most four vertices per column.
+     * The returned spans point into the simplifier (valid until the next
+     * call) or, if nothing could be removed, to the input.
+     */
+    class Simplifier
+    {
+    public:
+        // 0: off
+        explicit Simplifier(double t_tolerance_px = 0);
+        // Output pixels per page unit (render scale)
+        void set_scale(double t_scale);
+        [[nodiscard]] bool enabled() const;
+
+        Span<gvertex<double>> points(Span<gvertex<double>> t_points);
+        // Simplifies each subpath, t_nper is replaced with the new
+        // number of vertices per subpath.
+        Span<gvertex<double>> path(Span<gvertex<double>> t_points, Span<int> &t_nper);
+
+    private:
+        double m_tolerance_px;
+        double m_tolerance = 0; // page units
+        std::vector<gvertex<double>> m_points;
+        std::vector<int> m_nper;
+
+        void m_append(const gvertex<double> *t_begin, const gvertex<double> *t_end);
+    };
+
+} // namespace httpgd::dc
+
+#endif // HTTPGD_SIMPLIFY_H
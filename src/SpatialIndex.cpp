@@ -0,0 +1,231 @@
+#include "SpatialIndex.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace httpgd::dc
+{
+    // Cells per axis
+    static constexpr int grid_size = 64;
+    // Draw calls covering more cells are kept in the list of large draw calls
+    static constexpr int large_cells = 64;
+
+    double stroke_margin(const LineInfo &t_line)
+    {
+        if (t_line.lty == LineInfo::BLANK || color::transparent(t_line.col))
+        {
+            return 0;
+        }
+        // 1 lwd = 1/96", page units are 1/72", mitred corners reach further
+        return t_line.lwd / 96.0 * 72 / 2 * std::max(1.0, t_line.lmitre);
+    }
+
+    /**
+     * Computes the bounding box of draw calls.
+     */
+    class BoundsVisitor : public Renderer
+    {
+    public:
+        double x0, y0, x1, y1;
+
+        void text(const Text &t_text) override
+        {
+            // rotation and adjustment are not worth the effort
+            m_around(t_text.pos, t_text.txtwidth_px + t_text.text.fontsize);
+        }
+        void circle(const Circle &t_circle) override
+        {
+            m_around(t_circle.pos, t_circle.radius + stroke_margin(t_circle.line));
+        }
+        void line(const Line &t_line) override
+        {
+            const double m = stroke_margin(t_line.line);
+            m_reset();
+            m_add(t_line.orig, m);
+            m_add(t_line.dest, m);
+        }
+        void rect(const Rect &t_rect) override
+        {
+            const double m = stroke_margin(t_rect.line);
+            m_reset();
+            m_add({t_rect.rect.x, t_rect.rect.y}, m);
+            m_add({t_rect.rect.x + t_rect.rect.width, t_rect.rect.y + t_rect.rect.height}, m);
+        }
+        void polyline(const Polyline &t_polyline) override
+        {
+            m_points(t_polyline.points.begin(), t_polyline.points.end(), stroke_margin(t_polyline.line));
+        }
+        void polygon(const Polygon &t_polygon) override
+        {
+            m_points(t_polygon.points.begin(), t_polygon.points.end(), stroke_margin(t_polygon.line));
+        }
+        void path(const Path &t_path) override
+        {
+            m_points(t_path.points.begin(), t_path.points.end(), stroke_margin(t_path.line));
+        }
+        void raster(const Raster &t_raster) override
+        {
+            if (t_raster.rot != 0)
+            {
+                m_around({t_raster.rect.x, t_raster.rect.y}, std::hypot(t_raster.rect.width, t_raster.rect.height));
+                return;
+            }
+            m_reset();
+            m_add({t_raster.rect.x, t_raster.rect.y}, 0);
+            m_add({t_raster.rect.x + t_raster.rect.width, t_raster.rect.y + t_raster.rect.height}, 0);
+        }
+        void dc(const DrawCall &t_dc) override
+        {
+            // unknown, always visible
+            x0 = y0 = -HUGE_VAL;
+            x1 = y1 = HUGE_VAL;
+        }
+
+    private:
+        void m_around(gvertex<double> t_pos, double t_radius)
+        {
+            x0 = t_pos.x - t_radius;
+            y0 = t_pos.y - t_radius;
+            x1 = t_pos.x + t_radius;
+            y1 = t_pos.y + t_radius;
+        }
+        void m_reset()
+        {
+            x0 = y0 = HUGE_VAL;
+            x1 = y1 = -HUGE_VAL;
+        }
+        void m_points(const gvertex<double> *t_begin, const gvertex<double> *t_end, double t_margin)
+        {
+            m_reset();
+            for (auto it = t_begin; it != t_end; ++it)
+            {
+                m_add(*it, t_margin);
+            }
+        }
+        void m_add(gvertex<double> t_pos, double t_margin)
+        {
+            x0 = std::min(x0, t_pos.x - t_margin);
+            y0 = std::min(y0, t_pos.y - t_margin);
+            x1 = std::max(x1, t_pos.x + t_margin);
+            y1 = std::max(y1, t_pos.y + t_margin);
+        }
+    };
+
+    SpatialIndex::SpatialIndex(const Page &t_page)
+        : m_cell_size({std::max(t_page.size.x, 1.0) / grid_size, std::max(t_page.size.y, 1.0) / grid_size}),
+          m_cells(grid_size * grid_size)
+    {
+        m_bounds.reserve(t_page.dcs.size());
+        BoundsVisitor visitor;
+        for (std::size_t i = 0; i < t_page.dcs.size(); ++i)
+        {
+            t_page.render(t_page.dcs[i], &visitor);
+            const Box box{visitor.x0, visitor.y0, visitor.x1, visitor.y1};
+            m_bounds.push_back(box);
+            if (!(box.x0 <= box.x1 && box.y0 <= box.y1))
+            {
+                continue; // empty
+            }
+
+            int cx0, cy0, cx1, cy1;
+            m_cell_range(box, cx0, cy0, cx1, cy1);
+            const auto index = static_cast<std::uint32_t>(i);
+            if ((cx1 - cx0 + 1) * (cy1 - cy0 + 1) > large_cells)
+            {
+                m_large.push_back(index);
+                continue;
+            }
+            for (int cy = cy0; cy <= cy1; ++cy)
+            {
+                for (int cx = cx0; cx <= cx1; ++cx)
+                {
+                    m_cells[cy * grid_size + cx].push_back(index);
+                }
+            }
+        }
+    }
+
+    std::vector<DrawCall> SpatialIndex::query(const Page &t_page, grect<double> t_rect) const
+    {
+        const Box rect{t_rect.x, t_rect.y, t_rect.x + t_rect.width, t_rect.y + t_rect.height};
+        const auto intersects = [&](std::uint32_t t_index) {
+            const auto &box = m_bounds[t_index];
+            return box.x0 <= rect.x1 && box.x1 >= rect.x0 && box.y0 <= rect.y1 && box.y1 >= rect.y0;
+        };
+
+        std::vector<std::uint32_t> found;
+        int cx0, cy0, cx1, cy1;
+        m_cell_range(rect, cx0, cy0, cx1, cy1);
+        for (int cy = cy0; cy <= cy1; ++cy)
+        {
+            for (int cx = cx0; cx <= cx1; ++cx)
+            {
+                for (const auto index : m_cells[cy * grid_size + cx])
+                {
+                    if (intersects(index))
+                    {
+                        found.push_back(index);
+                    }
+                }
+            }
+        }
+        for (const auto index : m_large)
+        {
+            if (intersects(index))
+            {
+                found.push_back(index);
+            }
+        }
+
+        // draw calls that span several cells are found more than once
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+
+        std::vector<DrawCall> dcs;
+        dcs.reserve(found.size());
+        for (const auto index : found)
+        {
+            dcs.push_back(t_page.dcs[index]);
+        }
+        return dcs;
+    }
+
+    void SpatialIndex::m_cell_range(const Box &t_box, int &t_cx0, int &t_cy0, int &t_cx1, int &t_cy1) const
+    {
+        // Boxes outside of the page are clamped to the border cells
+        const auto cell = [](double t_pos, double t_cell_size) {
+            const double c = std::floor(t_pos / t_cell_size);
+            return static_cast<int>(std::max(0.0, std::min(static_cast<double>(grid_size - 1), c)));
+        };
+        t_cx0 = cell(t_box.x0, m_cell_size.x);
+        t_cy0 = cell(t_box.y0, m_cell_size.y);
+        t_cx1 = cell(t_box.x1, m_cell_size.x);
+        t_cy1 = cell(t_box.y1, m_cell_size.y);
+    }
+
+    VisibleDrawCalls::VisibleDrawCalls(const Page &t_page, const boost::optional<grect<double>> &t_viewport)
+        : m_dcs(&t_page.dcs)
+    {
+        if (t_viewport)
+        {
+            m_visible = t_page.query(*t_viewport);
+            m_dcs = &m_visible;
+        }
+    }
+
+    const std::vector<DrawCall> &VisibleDrawCalls::get() const
+    {
+        return *m_dcs;
+    }
+
+    std::vector<DrawCall>::const_iterator VisibleDrawCalls::begin() const
+    {
+        return m_dcs->begin();
+    }
+
+    std::vector<DrawCall>::const_iterator VisibleDrawCalls::end() const
+    {
+        return m_dcs->end();
+    }
+
+} // namespace httpgd::dc
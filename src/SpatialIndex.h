@@ -0,0 +1,75 @@
+#ifndef HTTPGD_SPATIAL_INDEX_H
+#define HTTPGD_SPATIAL_INDEX_H
+
+#include "DrawData.h"
+#include "HttpgdGeom.h"
+
+#include <boost/optional.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace httpgd::dc
+{
+    // Extent of the stroke of t_line beyond the outline of a shape
+    // (in page units), 0 if no stroke is drawn.
+    double stroke_margin(const LineInfo &t_line);
+
+    /**
+     * Uniform grid over the bounding boxes of the draw calls of a page.
+     * Draw calls are listed in every cell their bounding box touches,
+     * draw calls that cover a large part of the page are kept in a
+     * separate list that is checked on every query.
+     * The page builds it on the first query and drops it when draw
+     * calls are added.
+     */
+    class SpatialIndex
+    {
+    public:
+        explicit SpatialIndex(const Page &t_page);
+
+        // Draw calls whose bounding box intersects t_rect (page units),
+        // in drawing order.
+        [[nodiscard]] std::vector<DrawCall> query(const Page &t_page, grect<double> t_rect) const;
+
+    private:
+        struct Box
+        {
+            double x0, y0, x1, y1;
+        };
+
+        gvertex<double> m_cell_size;
+        std::vector<Box> m_bounds; // per draw call
+        std::vector<std::vector<std::uint32_t>> m_cells;
+        std::vector<std::uint32_t> m_large;
+
+        // range of cells covered by t_box (inclusive)
+        void m_cell_range(const Box &t_box, int &t_cx0, int &t_cy0, int &t_cx1, int &t_cy1) const;
+    };
+
+    // Area of the page that is rendered (page units)
+    inline grect<double> render_area(const Page &t_page, const boost::optional<grect<double>> &t_viewport)
+    {
+        return t_viewport ? *t_viewport : grect<double>{0, 0, t_page.size.x, t_page.size.y};
+    }
+
+    /**
+     * The draw calls to render: All draw calls of the page, or only those
+     * that are visible in the viewport (see RenderOptions::viewport).
+     */
+    class VisibleDrawCalls
+    {
+    public:
+        VisibleDrawCalls(const Page &t_page, const boost::optional<grect<double>> &t_viewport);
+
+        [[nodiscard]] const std::vector<DrawCall> &get() const;
+        [[nodiscard]] std::vector<DrawCall>::const_iterator begin() const;
+        [[nodiscard]] std::vector<DrawCall>::const_iterator end() const;
+
+    private:
+        std::vector<DrawCall> m_visible;
+        const std::vector<DrawCall> *m_dcs;
+    };
+
+} // namespace httpgd::dc
+
+#endif // HTTPGD_SPATIAL_INDEX_H
@@ -0,0 +1,278 @@
+#ifndef HTTPGD_TEXT_WRITER_H
+#define HTTPGD_TEXT_WRITER_H
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "DrawData.h"
+
+// Specialized writers for the hot paths of the text renderers.
+// fmt::format_to has to parse its format string on every call, which
+// dominates the render time of plots with many vertices. The output of
+// these functions is identical to the fmt format strings noted below.
+
+namespace httpgd::dc
+{
+    namespace detail
+    {
+        struct DigitPairs
+        {
+            char data[200];
+            constexpr DigitPairs() : data()
+            {
+                for (int i = 0; i < 100; ++i)
+                {
+                    data[i * 2] = static_cast<char>('0' + i / 10);
+                    data[i * 2 + 1] = static_cast<char>('0' + i % 10);
+                }
+            }
+        };
+        inline constexpr DigitPairs digit_pairs{};
+
+        struct HexPairs
+        {
+            char data[512];
+            constexpr HexPairs() : data()
+            {
+                constexpr const char *digits = "0123456789ABCDEF";
+                for (int i = 0; i < 256; ++i)
+                {
+                    data[i * 2] = digits[i >> 4];
+                    data[i * 2 + 1] = digits[i & 15];
+                }
+            }
+        };
+        inline constexpr HexPairs hex_pairs{};
+
+        // Writes the decimal digits of t_value right-aligned ending at t_end,
+        // returns the first digit.
+        inline char *write_digits_backwards(char *t_end, std::uint64_t t_value)
+        {
+            while (t_value >= 100)
+            {
+                t_end -= 2;
+                std::memcpy(t_end, digit_pairs.data + (t_value % 100) * 2, 2);
+                t_value /= 100;
+            }
+            if (t_value >= 10)
+            {
+                t_end -= 2;
+                std::memcpy(t_end, digit_pairs.data + t_value * 2, 2);
+            }
+            else
+            {
+                *--t_end = static_cast<char>('0' + t_value);
+            }
+            return t_end;
+        }
+    } // namespace detail
+
+    inline void write_str(fmt::memory_buffer &os, const char *t_str, std::size_t t_size)
+    {
+        os.append(t_str, t_str + t_size);
+    }
+
+    // String literals
+    template <std::size_t N>
+    inline void write_str(fmt::memory_buffer &os, const char (&t_str)[N])
+    {
+        os.append(t_str, t_str + N - 1);
+    }
+
+    inline void write_str(fmt::memory_buffer &os, const std::string &t_str)
+    {
+        os.append(t_str.data(), t_str.data() + t_str.size());
+    }
+
+    // "{}"
+    template <typename T>
+    inline void write_int(fmt::memory_buffer &os, T t_value)
+    {
+        const fmt::format_int f(t_value);
+        os.append(f.data(), f.data() + f.size());
+    }
+
+    // "{:.{}f}" with t_decimals (0-4)
+    inline void write_fixed(fmt::memory_buffer &os, double t_value, int t_decimals)
+    {
+        static constexpr double scales[] = {1.0, 10.0, 100.0, 1000.0, 10000.0};
+        static constexpr std::uint64_t iscales[] = {1, 10, 100, 1000, 10000};
+
+        // Values are rounded through an integer number of units of the last
+        // decimal. Anything too large for this to be exact, and values that
+        // are close to a tie after scaling, are left to fmt.
+        const double x = std::fabs(t_value) * scales[t_decimals];
+        const double n = std::floor(x);
+        const double f = x - n;
+        if (!(x < 1e11) || std::fabs(f - 0.5) < 1e-4)
+        {
+            fmt::format_to(std::back_inserter(os), "{:.{}f}", t_value, t_decimals);
+            return;
+        }
+        const auto units = static_cast<std::uint64_t>(n) + (f > 0.5 ? 1 : 0);
+
+        char buf[24];
+        char *end = buf + sizeof(buf);
+        if (t_decimals > 0)
+        {
+            auto frac = units % iscales[t_decimals];
+            for (int i = 0; i < t_decimals; ++i)
+            {
+                *--end = static_cast<char>('0' + frac % 10);
+                frac /= 10;
+            }
+            *--end = '.';
+        }
+        char *begin = detail::write_digits_backwards(end, units / iscales[t_decimals]);
+        if (std::signbit(t_value))
+        {
+            *--begin = '-';
+        }
+        os.append(begin, buf + sizeof(buf));
+    }
+
+    // "{:.2f}"
+    inline void write_fixed2(fmt::memory_buffer &os, double t_value)
+    {
+        write_fixed(os, t_value, 2);
+    }
+
+    // "#{:02X}{:02X}{:02X}"
+    inline void write_hex_color(fmt::memory_buffer &os, color_t t_color)
+    {
+        char buf[7];
+        buf[0] = '#';
+        std::memcpy(buf + 1, detail::hex_pairs.data + color::red(t_color) * 2, 2);
+        std::memcpy(buf + 3, detail::hex_pairs.data + color::green(t_color) * 2, 2);
+        std::memcpy(buf + 5, detail::hex_pairs.data + color::blue(t_color) * 2, 2);
+        os.append(buf, buf + sizeof(buf));
+    }
+
+    // Arguments of write_to()
+    struct Fixed
+    {
+        double value;
+        int decimals;
+    };
+    inline Fixed fixed2(double t_value)
+    {
+        return {t_value, 2};
+    }
+
+    // Format of coordinates and lengths, see RenderOptions.
+    struct CoordFormat
+    {
+        int decimals = 2;
+        double factor = 1.0;
+
+        CoordFormat() = default;
+        explicit CoordFormat(const RenderOptions &t_options)
+        {
+            const int precision = std::max(0, std::min(4, t_options.precision));
+            if (t_options.integer_coords)
+            {
+                decimals = 0;
+                factor = std::pow(10.0, precision);
+            }
+            else
+            {
+                decimals = precision;
+            }
+        }
+
+        Fixed operator()(double t_value) const
+        {
+            return {t_value * factor, decimals};
+        }
+    };
+
+    struct HexColor
+    {
+        color_t value;
+    };
+    inline HexColor hex_color(color_t t_color)
+    {
+        return {t_color};
+    }
+
+    template <std::size_t N>
+    inline void write_part(fmt::memory_buffer &os, const char (&t_str)[N])
+    {
+        write_str(os, t_str);
+    }
+    inline void write_part(fmt::memory_buffer &os, const std::string &t_str)
+    {
+        write_str(os, t_str);
+    }
+    inline void write_part(fmt::memory_buffer &os, Fixed t_fixed)
+    {
+        write_fixed(os, t_fixed.value, t_fixed.decimals);
+    }
+    inline void write_part(fmt::memory_buffer &os, HexColor t_color)
+    {
+        write_hex_color(os, t_color.value);
+    }
+    template <typename T>
+    inline void write_part(fmt::memory_buffer &os, const T &t_value)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            if (t_value)
+            {
+                write_str(os, "true");
+            }
+            else
+            {
+                write_str(os, "false");
+            }
+        }
+        else if constexpr (std::is_same_v<T, const char *>)
+        {
+            os.append(t_value, t_value + std::strlen(t_value));
+        }
+        else
+        {
+            static_assert(std::is_integral_v<T>, "unsupported argument type");
+            write_int(os, t_value);
+        }
+    }
+
+    // Writes all arguments in order: strings as they are, integers and
+    // booleans like "{}", fixed2() and CoordFormat values like "{:.{}f}"
+    // and hex_color() like "#{:02X}{:02X}{:02X}".
+    template <typename... Args>
+    inline void write_to(fmt::memory_buffer &os, const Args &...t_args)
+    {
+        (write_part(os, t_args), ...);
+    }
+
+    // Writes t_text, replacing characters for which t_escape returns a
+    // replacement (const char *, nullptr otherwise). Runs of characters
+    // that need no escaping are copied as a whole.
+    template <typename F>
+    inline void write_escaped(fmt::memory_buffer &os, const std::string &t_text, F &&t_escape)
+    {
+        const char *run = t_text.data();
+        const char *end = t_text.data() + t_text.size();
+        for (const char *it = run; it != end; ++it)
+        {
+            const char *replacement = t_escape(*it);
+            if (replacement)
+            {
+                os.append(run, it);
+                os.append(replacement, replacement + std::strlen(replacement));
+                run = it + 1;
+            }
+        }
+        os.append(run, end);
+    }
+
+} // namespace httpgd::dc
+
+#endif // HTTPGD_TEXT_WRITER_H
@@ -6,10 +6,10 @@
 #include <R_ext/Visibility.h>
 
 // Httpgd.cpp
-bool httpgd_(std::string host, int port, std::string bg, double width, double height, double pointsize, cpp11::list aliases, bool cors, std::string token, bool webserver, bool silent, bool fix_text_width, std::string extra_css, bool reset_par);
-extern "C" SEXP _httpgd_httpgd_(SEXP host, SEXP port, SEXP bg, SEXP width, SEXP height, SEXP pointsize, SEXP aliases, SEXP cors, SEXP token, SEXP webserver, SEXP silent, SEXP fix_text_width, SEXP extra_css, SEXP reset_par) {
+bool httpgd_(std::string host, int port, std::string bg, double width, double height, double pointsize, cpp11::list aliases, bool cors, std::string token, bool webserver, bool silent, bool fix_text_width, std::string extra_css, bool reset_par, int threads, int update_interval, int compression_level, int compression_min_size);
+extern "C" SEXP _httpgd_httpgd_(SEXP host, SEXP port, SEXP bg, SEXP width, SEXP height, SEXP pointsize, SEXP aliases, SEXP cors, SEXP token, SEXP webserver, SEXP silent, SEXP fix_text_width, SEXP extra_css, SEXP reset_par, SEXP threads, SEXP update_interval, SEXP compression_level, SEXP compression_min_size) {
   BEGIN_CPP11
-    return cpp11::as_sexp(httpgd_(cpp11::as_cpp<cpp11::decay_t<std::string>>(host), cpp11::as_cpp<cpp11::decay_t<int>>(port), cpp11::as_cpp<cpp11::decay_t<std::string>>(bg), cpp11::as_cpp<cpp11::decay_t<double>>(width), cpp11::as_cpp<cpp11::decay_t<double>>(height), cpp11::as_cpp<cpp11::decay_t<double>>(pointsize), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(aliases), cpp11::as_cpp<cpp11::decay_t<bool>>(cors), cpp11::as_cpp<cpp11::decay_t<std::string>>(token), cpp11::as_cpp<cpp11::decay_t<bool>>(webserver), cpp11::as_cpp<cpp11::decay_t<bool>>(silent), cpp11::as_cpp<cpp11::decay_t<bool>>(fix_text_width), cpp11::as_cpp<cpp11::decay_t<std::string>>(extra_css), cpp11::as_cpp<cpp11::decay_t<bool>>(reset_par)));
+    return cpp11::as_sexp(httpgd_(cpp11::as_cpp<cpp11::decay_t<std::string>>(host), cpp11::as_cpp<cpp11::decay_t<int>>(port), cpp11::as_cpp<cpp11::decay_t<std::string>>(bg), cpp11::as_cpp<cpp11::decay_t<double>>(width), cpp11::as_cpp<cpp11::decay_t<double>>(height), cpp11::as_cpp<cpp11::decay_t<double>>(pointsize), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(aliases), cpp11::as_cpp<cpp11::decay_t<bool>>(cors), cpp11::as_cpp<cpp11::decay_t<std::string>>(token), cpp11::as_cpp<cpp11::decay_t<bool>>(webserver), cpp11::as_cpp<cpp11::decay_t<bool>>(silent), cpp11::as_cpp<cpp11::decay_t<bool>>(fix_text_width), cpp11::as_cpp<cpp11::decay_t<std::string>>(extra_css), cpp11::as_cpp<cpp11::decay_t<bool>>(reset_par), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<int>>(update_interval), cpp11::as_cpp<cpp11::decay_t<int>>(compression_level), cpp11::as_cpp<cpp11::decay_t<int>>(compression_min_size)));
   END_CPP11
 }
 // Httpgd.cpp
@@ -62,17 +62,17 @@ extern "C" SEXP _httpgd_httpgd_plot_find_(SEXP devnum, SEXP plot_id) {
   END_CPP11
 }
 // Httpgd.cpp
-std::string httpgd_plot_str_(int devnum, int page, double width, double height, double zoom, std::string renderer_id);
-extern "C" SEXP _httpgd_httpgd_plot_str_(SEXP devnum, SEXP page, SEXP width, SEXP height, SEXP zoom, SEXP renderer_id) {
+cpp11::strings httpgd_plot_str_(int devnum, int page, double width, double height, double zoom, std::string renderer_id, int raster_threshold);
+extern "C" SEXP _httpgd_httpgd_plot_str_(SEXP devnum, SEXP page, SEXP width, SEXP height, SEXP zoom, SEXP renderer_id, SEXP raster_threshold) {
   BEGIN_CPP11
-    return cpp11::as_sexp(httpgd_plot_str_(cpp11::as_cpp<cpp11::decay_t<int>>(devnum), cpp11::as_cpp<cpp11::decay_t<int>>(page), cpp11::as_cpp<cpp11::decay_t<double>>(width), cpp11::as_cpp<cpp11::decay_t<double>>(height), cpp11::as_cpp<cpp11::decay_t<double>>(zoom), cpp11::as_cpp<cpp11::decay_t<std::string>>(renderer_id)));
+    return cpp11::as_sexp(httpgd_plot_str_(cpp11::as_cpp<cpp11::decay_t<int>>(devnum), cpp11::as_cpp<cpp11::decay_t<int>>(page), cpp11::as_cpp<cpp11::decay_t<double>>(width), cpp11::as_cpp<cpp11::decay_t<double>>(height), cpp11::as_cpp<cpp11::decay_t<double>>(zoom), cpp11::as_cpp<cpp11::decay_t<std::string>>(renderer_id), cpp11::as_cpp<cpp11::decay_t<int>>(raster_threshold)));
   END_CPP11
 }
 // Httpgd.cpp
-cpp11::raws httpgd_plot_raw_(int devnum, int page, double width, double height, double zoom, std::string renderer_id);
-extern "C" SEXP _httpgd_httpgd_plot_raw_(SEXP devnum, SEXP page, SEXP width, SEXP height, SEXP zoom, SEXP renderer_id) {
+cpp11::raws httpgd_plot_raw_(int devnum, int page, double width, double height, double zoom, std::string renderer_id, int raster_threshold);
+extern "C" SEXP _httpgd_httpgd_plot_raw_(SEXP devnum, SEXP page, SEXP width, SEXP height, SEXP zoom, SEXP renderer_id, SEXP raster_threshold) {
   BEGIN_CPP11
-    return cpp11::as_sexp(httpgd_plot_raw_(cpp11::as_cpp<cpp11::decay_t<int>>(devnum), cpp11::as_cpp<cpp11::decay_t<int>>(page), cpp11::as_cpp<cpp11::decay_t<double>>(width), cpp11::as_cpp<cpp11::decay_t<double>>(height), cpp11::as_cpp<cpp11::decay_t<double>>(zoom), cpp11::as_cpp<cpp11::decay_t<std::string>>(renderer_id)));
+    return cpp11::as_sexp(httpgd_plot_raw_(cpp11::as_cpp<cpp11::decay_t<int>>(devnum), cpp11::as_cpp<cpp11::decay_t<int>>(page), cpp11::as_cpp<cpp11::decay_t<double>>(width), cpp11::as_cpp<cpp11::decay_t<double>>(height), cpp11::as_cpp<cpp11::decay_t<double>>(zoom), cpp11::as_cpp<cpp11::decay_t<std::string>>(renderer_id), cpp11::as_cpp<cpp11::decay_t<int>>(raster_threshold)));
   END_CPP11
 }
 // Httpgd.cpp
@@ -122,15 +122,15 @@ extern "C" SEXP _httpgd_httpgd_ipc_close_() {
 
 extern "C" {
 static const R_CallMethodDef CallEntries[] = {
-    {"_httpgd_httpgd_",                 (DL_FUNC) &_httpgd_httpgd_,                 14},
+    {"_httpgd_httpgd_",                 (DL_FUNC) &_httpgd_httpgd_,                 18},
     {"_httpgd_httpgd_clear_",           (DL_FUNC) &_httpgd_httpgd_clear_,            1},
     {"_httpgd_httpgd_id_",              (DL_FUNC) &_httpgd_httpgd_id_,               3},
     {"_httpgd_httpgd_info_",            (DL_FUNC) &_httpgd_httpgd_info_,             1},
     {"_httpgd_httpgd_ipc_close_",       (DL_FUNC) &_httpgd_httpgd_ipc_close_,        0},
     {"_httpgd_httpgd_ipc_open_",        (DL_FUNC) &_httpgd_httpgd_ipc_open_,         0},
     {"_httpgd_httpgd_plot_find_",       (DL_FUNC) &_httpgd_httpgd_plot_find_,        2},
-    {"_httpgd_httpgd_plot_raw_",        (DL_FUNC) &_httpgd_httpgd_plot_raw_,         6},
-    {"_httpgd_httpgd_plot_str_",        (DL_FUNC) &_httpgd_httpgd_plot_str_,         6},
+    {"_httpgd_httpgd_plot_raw_",        (DL_FUNC) &_httpgd_httpgd_plot_raw_,         7},
+    {"_httpgd_httpgd_plot_str_",        (DL_FUNC) &_httpgd_httpgd_plot_str_,         7},
     {"_httpgd_httpgd_random_token_",    (DL_FUNC) &_httpgd_httpgd_random_token_,     1},
     {"_httpgd_httpgd_remove_",          (DL_FUNC) &_httpgd_httpgd_remove_,           2},
     {"_httpgd_httpgd_remove_id_",       (DL_FUNC) &_httpgd_httpgd_remove_id_,        2},
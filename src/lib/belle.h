@@ -135,6 +135,7 @@ SOFTWARE.
 #include <functional>
 #include <regex>
 #include <memory>
+#include <mutex>
 #include <chrono>
 #include <utility>
 #include <initializer_list>
@@ -992,7 +993,8 @@ class Server
 {
 public:
 
-  // NOTE Channel implementation is NOT thread safe
+  // thread safe: sessions may join, leave and be broadcast to
+  // from any thread
   class Channel
   {
   public:
@@ -1001,35 +1003,58 @@ public:
     {
     }
 
+    Channel(Channel const& other_)
+    {
+      std::lock_guard<std::mutex> lock {other_._mutex};
+      _sockets = other_._sockets;
+    }
+
+    Channel& operator=(Channel const& other_)
+    {
+      if (this != &other_)
+      {
+        std::scoped_lock lock {_mutex, other_._mutex};
+        _sockets = other_._sockets;
+      }
+      return *this;
+    }
+
     void join(Websocket_Session& socket_)
     {
+      std::lock_guard<std::mutex> lock {_mutex};
       _sockets.insert(&socket_);
     }
 
     void leave(Websocket_Session& socket_)
     {
+      std::lock_guard<std::mutex> lock {_mutex};
       _sockets.erase(&socket_);
     }
 
     void broadcast(std::string const&& str_) const
     {
+      std::lock_guard<std::mutex> lock {_mutex};
       for(auto const e : _sockets)
       {
-        e->send(std::move(str_));
+        // send only queues the message on the session strand
+        e->send(std::string(str_));
       }
     }
 
     std::size_t size() const
     {
+      std::lock_guard<std::mutex> lock {_mutex};
       return _sockets.size();
     }
 
   private:
 
+    mutable std::mutex _mutex;
     std::unordered_set<Websocket_Session*> _sockets;
   }; // class Channel
 
-  // NOTE Channels implementation is NOT thread safe
+  // NOTE Channels map is NOT thread safe, guard insertions with
+  // Attr::channels_mutex
   using Channels = std::unordered_map<std::string, Channel>;
 
   template<typename Body>
@@ -1038,6 +1063,31 @@ public:
     Request req {};
     http::response<Body> res {};
     std::shared_ptr<void> data {nullptr};
+
+    // takes the next chunk of a body sent with chunked transfer encoding,
+    // may be called from any thread. An empty chunk ends the body. Any
+    // other status than ok ends the response: with that status if nothing
+    // has been sent yet, by closing the connection otherwise.
+    using Chunk_Callback = std::function<void(std::string, Status)>;
+
+    // send the response body with chunked transfer encoding instead of
+    // res.body(), called on the session strand for every chunk once the
+    // previous one has been written. The header is sent with the first
+    // chunk, so the body can be produced while it is sent.
+    std::function<void(Chunk_Callback)> body_chunks {};
+
+    // send a buffer owned by someone else as the response body instead of
+    // res.body() without copying it, the owner is kept alive until the
+    // response has been written
+    template<typename Container>
+    void body_shared(std::shared_ptr<Container const> body_)
+    {
+      body_ref = net::const_buffer(body_->data(), body_->size());
+      body_owner = std::move(body_);
+    }
+
+    std::shared_ptr<void const> body_owner {nullptr};
+    net::const_buffer body_ref {};
   }; // class Http_Ctx_Basic
 
   using Http_Ctx = Http_Ctx_Basic<http::string_body>;
@@ -1161,6 +1211,7 @@ private:
 
     // websocket channels
     Channels channels {};
+    std::mutex channels_mutex {};
   }; // struct Attr
 
   template<typename Derived>
@@ -1185,7 +1236,10 @@ private:
     ~Websocket_Base()
     {
       // leave channel
-      _attr->channels.at(_ctx.req.path().at(0)).leave(derived());
+      {
+        std::lock_guard<std::mutex> lock {_attr->channels_mutex};
+        _attr->channels.at(_ctx.req.path().at(0)).leave(derived());
+      }
 
       if (_on_websocket.end)
       {
@@ -1214,10 +1268,25 @@ private:
       }
     }
 
+    // may be called from any thread, the write is queued on the strand
     void send(std::string const&& str_)
     {
       auto const pstr = std::make_shared<std::string const>(std::move(str_));
-      _que.emplace_back(pstr);
+
+      net::post(_strand,
+        [wself = _self, pstr]()
+        {
+          if (auto self = wself.lock())
+          {
+            self->do_send(pstr);
+          }
+        }
+      );
+    }
+
+    void do_send(std::shared_ptr<std::string const> const& pstr_)
+    {
+      _que.emplace_back(pstr_);
 
       if (_que.size() > 1)
       {
@@ -1225,10 +1294,12 @@ private:
       }
 
       derived().socket().async_write(net::buffer(*_que.front()),
-        [self = derived().shared_from_this()](error_code ec, std::size_t bytes)
-        {
-          self->on_write(ec, bytes);
-        }
+        net::bind_executor(_strand,
+          [self = derived().shared_from_this()](error_code ec, std::size_t bytes)
+          {
+            self->on_write(ec, bytes);
+          }
+        )
       );
     }
 
@@ -1292,12 +1363,18 @@ private:
         return;
       }
 
+      // remember self for sends queued from other threads
+      _self = derived().shared_from_this();
+
       // join channel
-      if (_attr->channels.find(_ctx.req.path().at(0)) == _attr->channels.end())
       {
-        _attr->channels[_ctx.req.path().at(0)] = Channel();
+        std::lock_guard<std::mutex> lock {_attr->channels_mutex};
+        if (_attr->channels.find(_ctx.req.path().at(0)) == _attr->channels.end())
+        {
+          _attr->channels[_ctx.req.path().at(0)] = Channel();
+        }
+        _attr->channels.at(_ctx.req.path().at(0)).join(derived());
       }
-      _attr->channels.at(_ctx.req.path().at(0)).join(derived());
 
       if (_attr->on_websocket_connect)
       {
@@ -1416,10 +1493,12 @@ private:
       }
 
       derived().socket().async_write(net::buffer(*_que.front()),
-        [self = derived().shared_from_this()](error_code ec, std::size_t bytes)
-        {
-          self->on_write(ec, bytes);
-        }
+        net::bind_executor(_strand,
+          [self = derived().shared_from_this()](error_code ec, std::size_t bytes)
+          {
+            self->on_write(ec, bytes);
+          }
+        )
       );
     }
 
@@ -1429,6 +1508,7 @@ private:
     net::strand<net::io_context::executor_type> _strand;
     boost::beast::multi_buffer _buf;
     std::deque<std::shared_ptr<std::string const>> _que {};
+    std::weak_ptr<Derived> _self {};
   }; // class Websocket_Base
 
   class Websocket :
@@ -1598,6 +1678,153 @@ private:
       );
     };
 
+    template<typename Ctx>
+    void send_shared(Ctx& ctx_)
+    {
+      struct Shared_Res
+      {
+        std::shared_ptr<void const> owner;
+        http::response<http::span_body<char const>> res;
+      };
+
+      auto ptr = std::make_shared<Shared_Res>();
+      ptr->owner = std::move(ctx_.body_owner);
+      ptr->res.base() = std::move(ctx_.res.base());
+      ptr->res.body() = {static_cast<char const*>(ctx_.body_ref.data()), ctx_.body_ref.size()};
+      ptr->res.content_length(ctx_.body_ref.size());
+      _res = ptr;
+
+      http::async_write(derived().socket(), ptr->res,
+        net::bind_executor(_strand,
+          [self = derived().shared_from_this(), close = ptr->res.need_eof()]
+          (error_code ec, std::size_t bytes)
+          {
+            self->on_write(ec, bytes, close);
+          }
+        )
+      );
+    }
+
+    struct Chunked_Res
+    {
+      http::response<http::empty_body> res;
+      http::response_serializer<http::empty_body> sr {res};
+      std::function<void(std::function<void(std::string, Status)>)> next;
+      std::string chunk;
+      bool header_sent {false};
+    };
+
+    template<typename Ctx>
+    void send_chunked(Ctx& ctx_)
+    {
+      auto ptr = std::make_shared<Chunked_Res>();
+      ptr->res.base() = std::move(ctx_.res.base());
+      ptr->res.chunked(true);
+      ptr->next = std::move(ctx_.body_chunks);
+      _res = ptr;
+
+      next_chunk(ptr);
+    }
+
+    void next_chunk(std::shared_ptr<Chunked_Res> ptr_)
+    {
+      auto self = derived().shared_from_this();
+
+      try
+      {
+        ptr_->next([self, ptr_](std::string chunk, Status status)
+        {
+          // the chunk may be produced on another thread
+          net::post(self->_strand,
+            [self, ptr_, chunk = std::move(chunk), status]() mutable
+            {
+              self->on_chunk(ptr_, std::move(chunk), status);
+            }
+          );
+        });
+      }
+      catch (...)
+      {
+        on_chunk(ptr_, {}, Status::internal_server_error);
+      }
+    }
+
+    void on_chunk(std::shared_ptr<Chunked_Res> ptr_, std::string chunk_, Status status_)
+    {
+      if (status_ != Status::ok)
+      {
+        if (ptr_->header_sent)
+        {
+          // a partial response can only be ended by closing
+          on_write({}, 0, true);
+          return;
+        }
+        _ctx.res.version(_ctx.req.version());
+        _ctx.res.keep_alive(_ctx.req.keep_alive());
+        serve_error(static_cast<int>(status_));
+        return;
+      }
+
+      ptr_->chunk = std::move(chunk_);
+
+      if (! ptr_->header_sent)
+      {
+        ptr_->header_sent = true;
+        http::async_write_header(derived().socket(), ptr_->sr,
+          net::bind_executor(_strand,
+            [self = derived().shared_from_this(), ptr_]
+            (error_code ec, std::size_t bytes)
+            {
+              boost::ignore_unused(bytes);
+              if (ec)
+              {
+                self->on_write(ec, 0, true);
+                return;
+              }
+              self->write_chunk(ptr_);
+            }
+          )
+        );
+        return;
+      }
+
+      write_chunk(ptr_);
+    }
+
+    void write_chunk(std::shared_ptr<Chunked_Res> ptr_)
+    {
+      if (ptr_->chunk.empty())
+      {
+        net::async_write(derived().socket(), http::make_chunk_last(),
+          net::bind_executor(_strand,
+            [self = derived().shared_from_this(), close = ptr_->res.need_eof()]
+            (error_code ec, std::size_t bytes)
+            {
+              self->on_write(ec, bytes, close);
+            }
+          )
+        );
+        return;
+      }
+
+      net::async_write(derived().socket(),
+        http::make_chunk(net::buffer(ptr_->chunk)),
+        net::bind_executor(_strand,
+          [self = derived().shared_from_this(), ptr_]
+          (error_code ec, std::size_t bytes)
+          {
+            boost::ignore_unused(bytes);
+            if (ec)
+            {
+              self->on_write(ec, 0, true);
+              return;
+            }
+            self->next_chunk(ptr_);
+          }
+        )
+      );
+    }
+
     int serve_static()
     {
       if (! _attr->http_static || _attr->public_dir.empty())
@@ -1715,6 +1942,18 @@ private:
               // run user function
               user_func(_ctx);
 
+              if (_ctx.body_chunks)
+              {
+                send_chunked(_ctx);
+                return 0;
+              }
+
+              if (_ctx.body_owner)
+              {
+                send_shared(_ctx);
+                return 0;
+              }
+
               _ctx.res.content_length(_ctx.res.body().size());
               send(derived().shared_from_this(), std::move(_ctx.res));
               return 0;
@@ -1814,6 +2053,18 @@ private:
               // run user function
               user_func(ctx_dyn);
 
+              if (ctx_dyn.body_chunks)
+              {
+                send_chunked(ctx_dyn);
+                return 0;
+              }
+
+              if (ctx_dyn.body_owner)
+              {
+                send_shared(ctx_dyn);
+                return 0;
+              }
+
               send(derived().shared_from_this(), std::move(ctx_dyn.res));
               return 0;
             }
@@ -2959,12 +3210,6 @@ public:
       _attr->http_headers.set(Header::server, "Belle");
     }
 
-    // websocket channels are not threadsafe, limit to 1 thread
-    if (_attr->websocket && _threads > 1)
-    {
-      _threads = 1;
-    }
-
     // create the listener
 #ifdef OB_BELLE_CONFIG_SSL_ON
     if (_attr->ssl)